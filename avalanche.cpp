@@ -1,11 +1,16 @@
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
 #include "raster.h"
 #include "grid_neighbours.h"
 #include "utility.h"
 #include "avalanche.h"
 
 
-Avalanche::Avalanche() : size_x(0), size_y(0) {}
+Avalanche::Avalanche() : size_x(0), size_y(0), ridge_cells(0), worklist_calls(0), worklist_seeds(0),
+        worklist_iterations(0), worklist_touched(0), melt_in_sweep(true), num_bands(0),
+        track_mass(false), failed_volume(0), deposited_volume(0), total_failed_volume(0), total_deposited_volume(0) {}
 
 void Avalanche::initialise(Raster& topo) {
     size_x = topo.get_size_x();
@@ -19,6 +24,20 @@ void Avalanche::initialise(Raster& topo) {
 	//  thresh_diag = thresh * sqrt2;
 	thresh = 0.577 * topo.get_deltax();   // Critical height in m above neighbouring pixel, at 30 deg  (TAN(RADIANS(33deg))*deltax
 	thresh_diag = thresh * sqrt2;
+
+    worklist.clear();
+    queued.assign(size_x * size_y, 0);
+    touched_stamp.assign(size_x * size_y, 0);
+    start_topo.assign(size_x * size_y, 0);
+    melt_lowered.assign(size_x * size_y, 0);
+    worklist_calls = 0;
+    worklist_seeds = 0;
+    worklist_iterations = 0;
+    worklist_touched = 0;
+    failed_volume = 0;
+    deposited_volume = 0;
+    total_failed_volume = 0;
+    total_deposited_volume = 0;
 }
 
 /// This routine runs through the points in the topo Raster from low to high elevations. It is assumed
@@ -33,71 +52,387 @@ void Avalanche::run(Raster& topo, Raster& sed_track, Raster& incoming_watts, rea
 
 	// NEED TO ASSESS WHETHER PIXEL HAS SEDIMENT, BEFORE FAILURE CALCS?
 
+    real_type failed = 0;
+    double change = 0;
+    double magnitude = 0;
     int t = 0;
     // Landsliding, proceeding from low elev to high
     while (t < size_x * size_y)
     {
         int i, j;
         topo.get_sorted_ij(t, i, j);
-        real_type clifftop = 0;
+        avalanche_cell(i, j, topo, sed_track, incoming_watts, melt, nebs, failed, change, magnitude);
+        t++;
+    }
+    check_mass_balance(failed, change, magnitude);
+}
+
+/// Cells whose 3x3 neighbourhood lies within a single watershed only read and write
+/// cells of that watershed, so each watershed's interior cells are processed from low
+/// to high by one thread, largest watersheds first. Ridge cells, whose neighbourhood
+/// spans more than one watershed, are then processed serially from low to high. The
+/// result does not depend on the number of threads, but differs slightly from run()
+/// because ridge cells are processed after the interior cells rather than interleaved.
+void Avalanche::run_basins(Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt,
+        GridNeighbours& nebs, const Array2D<int32_t>& labels) {
+    if (size_x != topo.get_size_x() || size_y != topo.get_size_y()) {
+        Util::Error("Must initialise Avalanche object", 1);
+    }
+
+    basins.reset(labels);
+    ridge.assign(size_x * size_y, 0);
+    #pragma omp parallel for
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            int label = basins.label(i, j);
+            ridge[i * size_y + j] = (basins.label(nebs.iup(i), j) != label) || (basins.label(nebs.idown(i), j) != label) ||
+                    (basins.label(i, nebs.jup(j)) != label) || (basins.label(i, nebs.jdown(j)) != label) ||
+                    (basins.label(nebs.iup(i), nebs.jup(j)) != label) || (basins.label(nebs.iup(i), nebs.jdown(j)) != label) ||
+                    (basins.label(nebs.idown(i), nebs.jup(j)) != label) || (basins.label(nebs.idown(i), nebs.jdown(j)) != label);
+        }
+    }
+    basins.build(topo, false, &ridge);
+
+    real_type failed = 0;
+    double change = 0;
+    double magnitude = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+: failed, change, magnitude)
+    for (int k = 0; k < basins.get_num_basins(); k++) {
+        int b = basins.get_basin(k);
+        const int* cells = basins.get_basin_cells(b);
+        for (int n = 0; n < basins.get_basin_size(b); n++) {
+            avalanche_cell(cells[n] / size_y, cells[n] % size_y, topo, sed_track, incoming_watts, melt, nebs,
+                    failed, change, magnitude);
+        }
+    }
+
+    // deterministic merge: ridge cells in sorted order
+    ridge_cells = 0;
+    for (int t = 0; t < size_x * size_y; t++) {
+        int i, j;
+        topo.get_sorted_ij(t, i, j);
+        if (ridge[i * size_y + j]) {
+            avalanche_cell(i, j, topo, sed_track, incoming_watts, melt, nebs, failed, change, magnitude);
+            ridge_cells++;
+        }
+    }
+    check_mass_balance(failed, change, magnitude);
+}
+
+/// New elevations are gathered first and written back afterwards, so no cell sees
+/// another cell's melt in the same call.
+void Avalanche::apply_melt(Raster& topo, Raster& incoming_watts, real_type melt, const std::vector<int>& cells,
+        GridNeighbours& nebs) {
+    if (size_x != topo.get_size_x() || size_y != topo.get_size_y()) {
+        Util::Error("Must initialise Avalanche object", 1);
+    }
+
+    int ncells = cells.size();
+    melted.resize(ncells);
+    #pragma omp parallel for
+    for (int k = 0; k < ncells; k++) {
+        melted[k] = melted_elevation(cells[k] / size_y, cells[k] % size_y, topo, incoming_watts, melt, nebs);
+    }
+    #pragma omp parallel for
+    for (int k = 0; k < ncells; k++) {
+        if (melted[k] < topo[cells[k]]) {
+            melt_lowered[cells[k]] = 1;
+        }
+        topo[cells[k]] = melted[k];
+    }
+}
+
+void Avalanche::clear_melt_lowered(const std::vector<int>& cells) {
+    for (int c : cells) {
+        melt_lowered[c] = 0;
+    }
+}
+
+/// Bands are fixed from the elevations at the start of the call, so each band is a
+/// contiguous range of the sorted cells. Within a band the cells are bucketed by colour
+/// with a stable counting sort, keeping the elevation order within each colour.
+void Avalanche::run_bands(Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt,
+        GridNeighbours& nebs, real_type band_height) {
+    if (size_x != topo.get_size_x() || size_y != topo.get_size_y()) {
+        Util::Error("Must initialise Avalanche object", 1);
+    }
+    if (band_height <= 0) {
+        Util::Error("Avalanche band height must be positive", 1);
+    }
+
+    int ncells = size_x * size_y;
+    band_cells.resize(ncells);
+    band_offsets.clear();
+    num_bands = 0;
+    int t0 = 0;
+    while (t0 < ncells) {
+        int i, j;
+        topo.get_sorted_ij(t0, i, j);
+        real_type band_top = topo(i, j) + band_height;
+        int t1 = t0 + 1;
+        int count[9] = {0};
+        count[(i % 3) * 3 + j % 3]++;
+        while (t1 < ncells) {
+            topo.get_sorted_ij(t1, i, j);
+            if (topo(i, j) >= band_top) {
+                break;
+            }
+            count[(i % 3) * 3 + j % 3]++;
+            t1++;
+        }
+
+        int next[9];
+        int start = t0;
+        for (int k = 0; k < 9; k++) {
+            next[k] = start;
+            band_offsets.push_back(start);
+            start += count[k];
+        }
+        for (int t = t0; t < t1; t++) {
+            topo.get_sorted_ij(t, i, j);
+            band_cells[next[(i % 3) * 3 + j % 3]++] = i * size_y + j;
+        }
+        num_bands++;
+        t0 = t1;
+    }
+    band_offsets.push_back(ncells);
 
-		//---------- Melt Happens Here ----------
+    real_type failed = 0;
+    double change = 0;
+    double magnitude = 0;
+    for (size_t k = 0; k + 1 < band_offsets.size(); k++) {
+        #pragma omp parallel for reduction(+: failed, change, magnitude)
+        for (int t = band_offsets[k]; t < band_offsets[k + 1]; t++) {
+            avalanche_cell(band_cells[t] / size_y, band_cells[t] % size_y, topo, sed_track, incoming_watts, melt, nebs,
+                    failed, change, magnitude);
+        }
+    }
+    check_mass_balance(failed, change, magnitude);
+}
 
-		if ((i > 0) && (i < (size_x - 1)) && (j > 0) && (j < (size_y - 1)))  // Do not alter boundary elements
-		{
-			if (incoming_watts(i, j) != 0) {
-				real_type elev_drop = 0;       // Decrease in elevation at central pixel, following ice melt
-				real_type accommodation = 0;   // Volume available to fill below central pixel, in the immediate neighbourhood
+/// Melt is applied first to all melting cells, lowest first, and avalanching is then
+/// relaxed from them and the oversteepened cells. Because melt is not interleaved with
+/// avalanching and the relaxation runs to convergence, the result differs slightly
+/// from run(). A cell lowered at the top of an overhang (the iup neighbour, as in
+/// avalanche_cell()) is never taken below its elevation at the start of the call less
+/// its sediment track depth, however many times it is lowered.
+void Avalanche::run_worklist(Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt,
+        GridNeighbours& nebs) {
+    if (size_x != topo.get_size_x() || size_y != topo.get_size_y()) {
+        Util::Error("Must initialise Avalanche object", 1);
+    }
+    if (track_mass) {
+        Util::Error("Avalanche mass tracking is not supported by run_worklist()", 1);
+    }
+    worklist_calls++;
 
-				// Elevations within 9-element neighbourhood NW-N-NE-W-ctr-E-SW-S-SE
-				std::vector<real_type> neighb{ topo(nebs.idown(i), nebs.jup(j)), topo(i, nebs.jup(j)), topo(nebs.iup(i), nebs.jup(j)),
-						topo(nebs.idown(i), j), topo(i, j), topo(nebs.iup(i), j),
-						topo(nebs.idown(i), nebs.jdown(j)), topo(i, nebs.jdown(j)), topo(nebs.iup(i), nebs.jdown(j)) };
-				real_type lowestpixel = *min_element(neighb.begin(), neighb.end());
+    // starting cells: melting cells and cells with a neighbour above the critical height
+    worklist.clear();
+    melt_cells.clear();
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            bool interior = (i > 0) && (i < size_x - 1) && (j > 0) && (j < size_y - 1);
+            if (melt_in_sweep && interior && incoming_watts(i, j) != 0) {
+                melt_cells.push_back(i * size_y + j);
+            }
+            else if (oversteepened(i, j, topo, nebs)) {
+                push_worklist(i * size_y + j, topo);
+            }
+        }
+    }
+    std::sort(melt_cells.begin(), melt_cells.end(), [&topo](int a, int b) { return topo[a] < topo[b]; });
+    for (int c : melt_cells) {
+        touch(c, topo);
+        melt_cell(c / size_y, c % size_y, topo, incoming_watts, melt, nebs);
+        push_worklist(c, topo);
+    }
+    worklist_seeds += worklist.size();
 
-				// Ice mass lost, based on ablation at each face
-				// incoming watts / meltrate / pixel area
+    // lower the higher neighbours of the lowest cell on the list until none are too high
+    while (!worklist.empty()) {
+        int c = worklist.top().idx;
+        worklist.pop();
+        queued[c] = 0;
+        worklist_iterations++;
 
-				for (int m = 0; m < 8; m++) {
-					if (topo(i, j) - neighb[m] > 0) accommodation += deltax2 * (topo(i, j) - neighb[m]);   // sum up all the volume available on pixels below the central pixel
-				}
+        int i = c / size_y;
+        int j = c % size_y;
+        const int ni[8] = {nebs.iup(i), nebs.idown(i), i, i, nebs.iup(i), nebs.iup(i), nebs.idown(i), nebs.idown(i)};
+        const int nj[8] = {j, j, nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j)};
+        for (int m = 0; m < 8; m++) {
+            int n = ni[m] * size_y + nj[m];
+            real_type limit = topo[c] + (m < 4 ? thresh : thresh_diag);
+            if (topo[n] <= limit) {
+                continue;
+            }
+            if (m == 0) {
+                real_type start = (touched_stamp[n] == worklist_calls) ? start_topo[n] : topo[n];
+                limit = std::max(limit, start - sed_track[n]);
+            }
+            if (limit < topo[n]) {
+                touch(n, topo);
+                topo[n] = limit;
+                push_worklist(n, topo);
+            }
+        }
+    }
+}
 
-				elev_drop = incoming_watts(i, j) / melt / deltax2;
-				if (elev_drop * deltax < accommodation)           // i.e. There is room to accommodate the failed mass in neighbouring cells
-					topo(i, j) -= elev_drop;
-				else
-					topo(i, j) = lowestpixel;
+bool Avalanche::oversteepened(int i, int j, Raster& topo, GridNeighbours& nebs) const {
+    real_type h = topo(i, j);
+    return (topo(nebs.iup(i), j) - h > thresh) || (topo(nebs.idown(i), j) - h > thresh) ||
+            (topo(i, nebs.jup(j)) - h > thresh) || (topo(i, nebs.jdown(j)) - h > thresh) ||
+            (topo(nebs.iup(i), nebs.jup(j)) - h > thresh_diag) || (topo(nebs.iup(i), nebs.jdown(j)) - h > thresh_diag) ||
+            (topo(nebs.idown(i), nebs.jup(j)) - h > thresh_diag) || (topo(nebs.idown(i), nebs.jdown(j)) - h > thresh_diag);
+}
 
+void Avalanche::touch(int c, Raster& topo) {
+    if (touched_stamp[c] != worklist_calls) {
+        touched_stamp[c] = worklist_calls;
+        start_topo[c] = topo[c];
+        worklist_touched++;
+    }
+}
 
-				// Water lost in melt flows downstream (add to 'flow' raster)
+void Avalanche::push_worklist(int c, Raster& topo) {
+    if (!queued[c]) {
+        queued[c] = 1;
+        worklist.push(topo[c], c);
+    }
+}
+
+/// With mass tracking, material that fails from a neighbour is moved onto this cell
+/// rather than removed: the neighbour and this cell move by the same height d, chosen
+/// so that they end up at the critical height apart, d = (excess above critical) / 2.
+/// The failed material is carried in sed_track, taken from the neighbour's sediment
+/// first and added to this cell's, so sediment cover builds up where failures
+/// deposit. As for the lowering-only rule, the neighbour above along i is not
+/// lowered by more than its sediment track depth. The change in elevation each
+/// failure makes to the two cells, as stored, is added to change for
+/// check_mass_balance().
+void Avalanche::avalanche_cell(int i, int j, Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt,
+        GridNeighbours& nebs, real_type& failed, double& change, double& magnitude) {
+    real_type clifftop = 0;
+
+	//---------- Melt Happens Here ----------
+
+    melt_cell(i, j, topo, incoming_watts, melt, nebs);
+
+	//---------- Avalanching Happens Here ----------
+
+    if (track_mass) {
+        const int ni[8] = {nebs.iup(i), nebs.idown(i), i, i, nebs.iup(i), nebs.iup(i), nebs.idown(i), nebs.idown(i)};
+        const int nj[8] = {j, j, nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j)};
+        int c = i * size_y + j;
+        for (int m = 0; m < 8; m++) {
+            int n = ni[m] * size_y + nj[m];
+            real_type excess = topo[n] - topo[c] - (m < 4 ? thresh : thresh_diag);
+            if (excess <= 0) {
+                continue;
+            }
+            real_type d = 0.5 * excess;
+            if (m == 0) {
+                d = std::min(d, sed_track[n]);
+            }
+            real_type old_n = topo[n];
+            real_type old_c = topo[c];
+            topo[n] -= d;
+            sed_track[n] = std::max<real_type>(sed_track[n] - d, 0);
+            topo[c] += d;
+            sed_track[c] += d;
+            failed += d * deltax2;
+            change += (topo[n] - old_n) + (topo[c] - old_c);
+            magnitude += std::abs(old_n) + std::abs(old_c);
+        }
+        return;
+    }
+
+    if (topo(nebs.iup(i), j) - topo(i, j) > thresh) {
+        clifftop = topo(nebs.iup(i), j);    // Height of overhanging pixel
+        topo(nebs.iup(i), j) = std::max((topo(i, j) + thresh), (topo(nebs.iup(i), j) - sed_track(nebs.iup(i), j)));
+    }
+
+    if (topo(nebs.idown(i), j) - topo(i, j) > thresh)
+        topo(nebs.idown(i), j) = topo(i, j) + thresh;
+    if (topo(i, nebs.jup(j)) - topo(i, j) > thresh)
+        topo(i, nebs.jup(j)) = topo(i, j) + thresh;
+    if (topo(i, nebs.jdown(j)) - topo(i, j) > thresh)
+        topo(i, nebs.jdown(j)) = topo(i, j) + thresh;
+    if (topo(nebs.iup(i), nebs.jup(j)) - topo(i, j) > (thresh_diag))
+        topo(nebs.iup(i), nebs.jup(j)) = topo(i, j) + thresh_diag;
+    if (topo(nebs.iup(i), nebs.jdown(j)) - topo(i, j) > (thresh_diag))
+        topo(nebs.iup(i), nebs.jdown(j)) = topo(i, j) + thresh_diag;
+
+    if (topo(nebs.idown(i), nebs.jup(j)) - topo(i, j) > (thresh_diag))
+        topo(nebs.idown(i), nebs.jup(j)) = topo(i, j) + thresh_diag;
+    if (topo(nebs.idown(i), nebs.jdown(j)) - topo(i, j) > (thresh_diag))
+        topo(nebs.idown(i), nebs.jdown(j)) = topo(i, j) + thresh_diag;
+
+	// Update SedTrack, somewhere around here
+}
+
+real_type Avalanche::melt_cell(int i, int j, Raster& topo, Raster& incoming_watts, real_type melt,
+        GridNeighbours& nebs) {
+	if (melt_in_sweep && (i > 0) && (i < (size_x - 1)) && (j > 0) && (j < (size_y - 1)))  // Do not alter boundary elements
+	{
+		if (incoming_watts(i, j) != 0) {
+			real_type before = topo(i, j);
+			topo(i, j) = melted_elevation(i, j, topo, incoming_watts, melt, nebs);
+			if (topo(i, j) < before) {
+				melt_lowered[i * size_y + j] = 1;
 			}
+			return before - topo(i, j);
 		}
+	}
+	return 0;
+}
 
-		//---------- Avalanching Happens Here ----------
+real_type Avalanche::melted_elevation(int i, int j, Raster& topo, Raster& incoming_watts, real_type melt,
+        GridNeighbours& nebs) const {
+	real_type elev_drop = 0;       // Decrease in elevation at central pixel, following ice melt
+	real_type accommodation = 0;   // Volume available to fill below central pixel, in the immediate neighbourhood
 
-        if (topo(nebs.iup(i), j) - topo(i, j) > thresh) {
-            clifftop = topo(nebs.iup(i), j);    // Height of overhanging pixel
-            topo(nebs.iup(i), j) = std::max((topo(i, j) + thresh), (topo(nebs.iup(i), j) - sed_track(nebs.iup(i), j)));
-        }
+	// Elevations within 9-element neighbourhood NW-N-NE-W-ctr-E-SW-S-SE
+	const real_type neighb[9] = { topo(nebs.idown(i), nebs.jup(j)), topo(i, nebs.jup(j)), topo(nebs.iup(i), nebs.jup(j)),
+			topo(nebs.idown(i), j), topo(i, j), topo(nebs.iup(i), j),
+			topo(nebs.idown(i), nebs.jdown(j)), topo(i, nebs.jdown(j)), topo(nebs.iup(i), nebs.jdown(j)) };
+	real_type lowestpixel = *std::min_element(neighb, neighb + 9);
 
-        if (topo(nebs.idown(i), j) - topo(i, j) > thresh)
-            topo(nebs.idown(i), j) = topo(i, j) + thresh;
-        if (topo(i, nebs.jup(j)) - topo(i, j) > thresh)
-            topo(i, nebs.jup(j)) = topo(i, j) + thresh;
-        if (topo(i, nebs.jdown(j)) - topo(i, j) > thresh)
-            topo(i, nebs.jdown(j)) = topo(i, j) + thresh;
-        if (topo(nebs.iup(i), nebs.jup(j)) - topo(i, j) > (thresh_diag))
-            topo(nebs.iup(i), nebs.jup(j)) = topo(i, j) + thresh_diag;
-        if (topo(nebs.iup(i), nebs.jdown(j)) - topo(i, j) > (thresh_diag))
-            topo(nebs.iup(i), nebs.jdown(j)) = topo(i, j) + thresh_diag;
+	// Ice mass lost, based on ablation at each face
+	// incoming watts / meltrate / pixel area
 
-        if (topo(nebs.idown(i), nebs.jup(j)) - topo(i, j) > (thresh_diag))
-            topo(nebs.idown(i), nebs.jup(j)) = topo(i, j) + thresh_diag;
-        if (topo(nebs.idown(i), nebs.jdown(j)) - topo(i, j) > (thresh_diag))
-            topo(nebs.idown(i), nebs.jdown(j)) = topo(i, j) + thresh_diag;
+	for (int m = 0; m < 8; m++) {
+		if (topo(i, j) - neighb[m] > 0) accommodation += deltax2 * (topo(i, j) - neighb[m]);   // sum up all the volume available on pixels below the central pixel
+	}
 
-		// Update SedTrack, somewhere around here
+	// Water lost in melt flows downstream: routed by MFDFlowRouter when [flow] route_meltwater is set
+	elev_drop = incoming_watts(i, j) / melt / deltax2;
+	if (elev_drop * deltax < accommodation)           // i.e. There is room to accommodate the failed mass in neighbouring cells
+		return topo(i, j) - elev_drop;
+	else
+		return lowestpixel;
+}
 
-        t++;
+/// The neighbours of edge cells are clamped to the grid, so no material leaves through
+/// the edges. The deposited volume is the failed volume plus the net change the
+/// failures made to the stored elevations, which is summed per thread during the
+/// sweep rather than measured by another pass over the grid. Each update is rounded
+/// to the stored elevation, which sets the tolerance.
+void Avalanche::check_mass_balance(real_type failed, double change, double magnitude) {
+    if (!track_mass) {
+        failed_volume = 0;
+        deposited_volume = 0;
+        return;
+    }
+    real_type deposited = failed + change * deltax2;
+    real_type tolerance = 16 * std::numeric_limits<real_type>::epsilon() * magnitude * deltax2;
+
+    failed_volume = failed;
+    deposited_volume = deposited;
+    total_failed_volume += failed;
+    total_deposited_volume += deposited;
+    if (std::abs(failed - deposited) > tolerance) {
+        Util::Warning("Avalanche mass balance: " + std::to_string(failed) + " m3 failed but " +
+                std::to_string(deposited) + " m3 deposited");
     }
 }
@@ -4,6 +4,10 @@
 #include "grid_neighbours.h"
 #include "raster.h"
 #include "global_defs.h"
+#include "basin_decomposition.h"
+#include "Array2D.hpp"
+#include "flood_queue.hpp"
+#include <vector>
 
 /// \brief Avalanching
 class Avalanche {
@@ -14,6 +18,57 @@ class Avalanche {
 		real_type deltax2;
         real_type thresh;  ///< Critical height in m above neighbouring pixel
         real_type thresh_diag;  ///< Critical height in m above neighbouring pixel along a diagonal
+        BasinDecomposition basins;  ///< Watersheds processed independently by run_basins()
+        std::vector<char> ridge;  ///< Cells whose neighbourhood spans more than one watershed
+        long ridge_cells;  ///< Number of ridge cells in the last call to run_basins()
+        FloodQueue<real_type> worklist;  ///< Cells whose higher neighbours may need lowering, lowest first
+        std::vector<char> queued;  ///< Flags the cells currently in worklist
+        std::vector<int> melt_cells;  ///< Cells with melt in the current call to run_worklist()
+        std::vector<int> touched_stamp;  ///< Call of run_worklist() in which each cell was last melted or lowered
+        std::vector<real_type> start_topo;  ///< Elevation of each melted or lowered cell at the start of the call
+        int worklist_calls;  ///< Number of calls to run_worklist()
+        long worklist_seeds;  ///< Number of cells the worklist started with in all calls to run_worklist()
+        long worklist_iterations;  ///< Number of cells taken off the worklist in all calls to run_worklist()
+        long worklist_touched;  ///< Number of cells melted or lowered in all calls to run_worklist()
+        bool melt_in_sweep;  ///< Apply melt while avalanching, see set_melt_in_sweep()
+        std::vector<real_type> melted;  ///< New elevation of each melting cell in apply_melt()
+        std::vector<char> melt_lowered;  ///< Flags the cells lowered by melt since clear_melt_lowered()
+        std::vector<int> band_cells;  ///< Cells of each elevation band grouped by colour, in sorted order within a colour
+        std::vector<int> band_offsets;  ///< Start of each colour of each band in band_cells
+        long num_bands;  ///< Number of elevation bands in the last call to run_bands()
+        bool track_mass;  ///< Deposit failed material on the lower cell instead of removing it
+        real_type failed_volume;  ///< Volume (m3) failed in the last call to run(), run_basins() or run_bands()
+        real_type deposited_volume;  ///< Volume (m3) deposited in the last call
+        real_type total_failed_volume;  ///< Volume (m3) failed since initialise()
+        real_type total_deposited_volume;  ///< Volume (m3) deposited since initialise()
+
+        /// \brief Apply melt and avalanching at one cell
+        ///
+        /// With mass tracking, adds the failed volume (m3), the net change in elevation (m) of the cells the
+        /// failures moved, and the size of those elevations for the rounding tolerance.
+        void avalanche_cell(int i, int j, Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt,
+                GridNeighbours& nebs, real_type& failed, double& change, double& magnitude);
+
+        /// \brief Work out the volume deposited in the last call from the summed change in elevation and warn if
+        /// it does not balance the failed volume
+        void check_mass_balance(real_type failed, double change, double magnitude);
+
+        /// \brief Apply melt at one cell, boundary cells are not melted
+        /// \return The drop in elevation (m)
+        real_type melt_cell(int i, int j, Raster& topo, Raster& incoming_watts, real_type melt, GridNeighbours& nebs);
+
+        /// \brief Elevation of an interior cell after melt, from the current elevations of its neighbourhood
+        real_type melted_elevation(int i, int j, Raster& topo, Raster& incoming_watts, real_type melt,
+                GridNeighbours& nebs) const;
+
+        /// \brief Check whether any neighbour of a cell is above the critical height
+        bool oversteepened(int i, int j, Raster& topo, GridNeighbours& nebs) const;
+
+        /// \brief Record the elevation of a cell the first time it is changed by run_worklist()
+        void touch(int c, Raster& topo);
+
+        /// \brief Add a cell to the worklist if it is not already on it
+        void push_worklist(int c, Raster& topo);
 
     public:
         /// \brief Create an Avalanche object
@@ -30,6 +85,119 @@ class Avalanche {
         /// \param melt The reciprocal melt rate parameter
         /// \param nebs GridNeighbours instance for neighbour indexing
 		void run(Raster & topo, Raster & sed_track, Raster & incoming_watts, real_type melt, GridNeighbours & nebs);
+
+        /// \brief Run the avalanche code, processing the interior of each watershed in parallel
+        /// \param topo The Raster of elevations
+        /// \param sed_track The Raster of sediment track depth
+        /// \param incoming_watts The Raster of incoming watts computed in RadiationModel::melt_potential()
+        /// \param melt The reciprocal melt rate parameter
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        /// \param labels Watershed labels from the flood (see Flood::get_labels())
+        void run_basins(Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt, GridNeighbours& nebs,
+                const Array2D<int32_t>& labels);
+
+        /// \brief Apply melt to a list of cells as a separate stage before avalanching
+        ///
+        /// Every cell's new elevation is computed from the elevations before this call
+        /// (a Jacobi update), so the cells can be melted in parallel and in any order.
+        /// This is a different model from the melt in the avalanche sweep, not a faster
+        /// way to get the same result: the sweep melts each cell after its lower
+        /// neighbours have melted and avalanched, which can leave more room below it,
+        /// while here no cell sees another's melt or any collapse. Where melting cells
+        /// are apart and nothing collapses onto them the two agree.
+        /// The avalanche routines still apply melt themselves unless
+        /// set_melt_in_sweep(false) has been called.
+        /// \param topo The Raster of elevations
+        /// \param incoming_watts The Raster of incoming watts computed in RadiationModel::melt_potential()
+        /// \param melt The reciprocal melt rate parameter
+        /// \param cells Interior cells with nonzero incoming watts, from RadiationModel::get_melt_cells()
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        void apply_melt(Raster& topo, Raster& incoming_watts, real_type melt, const std::vector<int>& cells,
+                GridNeighbours& nebs);
+
+        /// \brief Choose whether the avalanche routines apply melt themselves (the default), false when melt is
+        /// applied by apply_melt()
+        void set_melt_in_sweep(bool melt_in_sweep_) { melt_in_sweep = melt_in_sweep_; }
+
+        /// \brief Forget which of these cells were lowered by melt, before the melt of a new time step
+        /// \param cells Cells that may be melted this step, from RadiationModel::get_melt_cells()
+        void clear_melt_lowered(const std::vector<int>& cells);
+
+        /// \brief Whether melt has lowered a cell since clear_melt_lowered()
+        ///
+        /// Melting cells whose neighbourhood cannot take the melted mass only drop to
+        /// their lowest neighbour, so a cell with incoming watts may not be lowered at all.
+        bool get_melt_lowered(int c) const { return melt_lowered[c] != 0; }
+
+        /// \brief Run the avalanche code as a relaxation from the cells that can fail
+        ///
+        /// The worklist starts with the cells that melt this step and the cells with a
+        /// neighbour above the critical height. Cells are taken from it lowest first;
+        /// each higher neighbour above the critical height is lowered and added to the
+        /// list, until no neighbour anywhere is above the critical height. The cost
+        /// depends on the number of failing cells rather than the size of the grid,
+        /// apart from one scan to find the starting cells, and topo does not need to
+        /// be sorted.
+        /// \param topo The Raster of elevations
+        /// \param sed_track The Raster of sediment track depth
+        /// \param incoming_watts The Raster of incoming watts computed in RadiationModel::melt_potential()
+        /// \param melt The reciprocal melt rate parameter
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        void run_worklist(Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt, GridNeighbours& nebs);
+
+        /// \brief Run the avalanche code in parallel over elevation bands
+        ///
+        /// The sorted cells are split into bands of elevation band_height. Avalanching a
+        /// cell changes only its 3 x 3 neighbourhood, so cells three or more rows or
+        /// columns apart never interfere; within a band the cells are coloured by
+        /// (i mod 3, j mod 3) and each of the nine colours is processed in parallel,
+        /// with a barrier between colours and between bands. The result does not depend
+        /// on the number of threads, but within a band neighbouring cells are visited
+        /// by colour rather than by elevation, so it differs slightly from run().
+        /// Assumes pit filling and Raster::sort_data() have been called on topo.
+        /// \param topo The Raster of elevations
+        /// \param sed_track The Raster of sediment track depth
+        /// \param incoming_watts The Raster of incoming watts computed in RadiationModel::melt_potential()
+        /// \param melt The reciprocal melt rate parameter
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        /// \param band_height Height of each elevation band in m
+        void run_bands(Raster& topo, Raster& sed_track, Raster& incoming_watts, real_type melt, GridNeighbours& nebs,
+                real_type band_height);
+
+        /// \brief Choose whether failed material is deposited on the lower cell and tracked in sed_track
+        ///
+        /// Applies to run(), run_basins() and run_bands(); run_worklist() does not support it.
+        void set_track_mass(bool track_mass_) { track_mass = track_mass_; }
+
+        /// \brief Volume (m3) failed in the last call to run(), run_basins() or run_bands() with mass tracking
+        real_type get_failed_volume() const { return failed_volume; }
+
+        /// \brief Volume (m3) deposited in the last call to run(), run_basins() or run_bands() with mass tracking
+        real_type get_deposited_volume() const { return deposited_volume; }
+
+        /// \brief Volume (m3) failed since initialise()
+        real_type get_total_failed_volume() const { return total_failed_volume; }
+
+        /// \brief Volume (m3) deposited since initialise()
+        real_type get_total_deposited_volume() const { return total_deposited_volume; }
+
+        /// \brief Number of elevation bands in the last call to run_bands()
+        long get_num_bands() const { return num_bands; }
+
+        /// \brief Number of ridge cells processed serially in the last call to run_basins()
+        long get_ridge_cells() const { return ridge_cells; }
+
+        /// \brief Number of calls to run_worklist() since initialise()
+        int get_worklist_calls() const { return worklist_calls; }
+
+        /// \brief Number of cells the worklist started with in all calls to run_worklist()
+        long get_worklist_seeds() const { return worklist_seeds; }
+
+        /// \brief Number of cells taken off the worklist in all calls to run_worklist()
+        long get_worklist_iterations() const { return worklist_iterations; }
+
+        /// \brief Number of cells melted or lowered in all calls to run_worklist()
+        long get_worklist_touched() const { return worklist_touched; }
 };
 
 #endif
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <numeric>
+#include "raster.h"
+#include "utility.h"
+#include "basin_decomposition.h"
+
+
+BasinDecomposition::BasinDecomposition() : size_x(0), size_y(0) {}
+
+void BasinDecomposition::reset(const Array2D<int32_t>& labels) {
+    size_x = labels.viewWidth();
+    size_y = labels.viewHeight();
+
+    int nlabels = 1;
+    cell_label.resize(size_x * size_y);
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            int label = std::max(labels(i, j), 0);
+            cell_label[i * size_y + j] = label;
+            nlabels = std::max(nlabels, label + 1);
+        }
+    }
+
+    parent.resize(nlabels);
+    std::iota(parent.begin(), parent.end(), 0);
+}
+
+int BasinDecomposition::find(int label) {
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+/// The lower label always becomes the root so the result does not depend on the order
+/// of the merges.
+void BasinDecomposition::merge(int label1, int label2) {
+    int root1 = find(label1);
+    int root2 = find(label2);
+    if (root1 < root2) {
+        parent[root2] = root1;
+    }
+    else if (root2 < root1) {
+        parent[root1] = root2;
+    }
+}
+
+void BasinDecomposition::build(Raster& topo, bool descending, const std::vector<char>* skip) {
+    if (topo.get_size_x() != size_x || topo.get_size_y() != size_y) {
+        Util::Error("BasinDecomposition labels do not match the Raster", 1);
+    }
+    int nlabels = parent.size();
+    int ncells = size_x * size_y;
+
+    // count cells per merged basin
+    offsets.assign(nlabels + 1, 0);
+    for (int c = 0; c < ncells; c++) {
+        if (skip == nullptr || !(*skip)[c]) {
+            offsets[find(cell_label[c]) + 1]++;
+        }
+    }
+    for (int b = 0; b < nlabels; b++) {
+        offsets[b + 1] += offsets[b];
+    }
+
+    // fill in sorted order
+    cells.resize(offsets[nlabels]);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int n = 0; n < ncells; n++) {
+        int i, j;
+        topo.get_sorted_ij(descending ? ncells - 1 - n : n, i, j);
+        int c = i * size_y + j;
+        if (skip == nullptr || !(*skip)[c]) {
+            cells[fill[find(cell_label[c])]++] = c;
+        }
+    }
+
+    // non-empty basins, largest first (ties by basin index so the order is deterministic)
+    order.clear();
+    for (int b = 0; b < nlabels; b++) {
+        if (offsets[b + 1] > offsets[b]) {
+            order.push_back(b);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](int b1, int b2) {
+        int size1 = get_basin_size(b1);
+        int size2 = get_basin_size(b2);
+        return (size1 > size2) || (size1 == size2 && b1 < b2);
+    });
+}
@@ -0,0 +1,62 @@
+#ifndef _BASIN_DECOMPOSITION_H_
+#define _BASIN_DECOMPOSITION_H_
+
+#include <vector>
+#include <cstdint>
+#include "raster.h"
+#include "Array2D.hpp"
+
+/// \brief Splits the grid into basins that can be processed independently
+///
+/// Basins start out as the watershed labels from the flood (one per draining edge
+/// cell). Components that need to exchange data across a basin boundary call merge()
+/// to join two basins; build() then lists the cells of every merged basin in sorted
+/// elevation order, with the basins ordered largest first so that the biggest pieces
+/// of work are started first when they are shared between threads.
+class BasinDecomposition {
+    private:
+        int size_x;  ///< Number of cells in the x dimension
+        int size_y;  ///< Number of cells in the y dimension
+        std::vector<int> parent;  ///< Union-find forest over the labels
+        std::vector<int> cell_label;  ///< Label of each cell (index i * size_y + j), 0 for unlabelled cells
+        std::vector<int> offsets;  ///< Start of each basin's cells in cells
+        std::vector<int> cells;  ///< Cells of every basin in sorted elevation order
+        std::vector<int> order;  ///< Basins, largest first
+
+    public:
+        /// \brief Create an empty BasinDecomposition object
+        BasinDecomposition();
+
+        /// \brief Start a new decomposition with one basin per watershed label
+        /// \param labels Watershed labels from the flood, indexed (i, j)
+        void reset(const Array2D<int32_t>& labels);
+
+        /// \brief Label of the basin a cell starts in
+        int label(int i, int j) const { return cell_label[i * size_y + j]; }
+
+        /// \brief The merged basin containing a label
+        int find(int label);
+
+        /// \brief Join the basins containing two labels
+        void merge(int label1, int label2);
+
+        /// \brief List the cells of each merged basin in sorted order
+        /// \param topo The Raster of elevations; Raster::sort_data() must have been called
+        /// \param descending Order cells from high to low rather than low to high
+        /// \param skip Optional flags (index i * size_y + j) of cells to leave out
+        void build(Raster& topo, bool descending, const std::vector<char>* skip = nullptr);
+
+        /// \brief Number of merged basins
+        int get_num_basins() const { return order.size(); }
+
+        /// \brief Index of the k'th largest merged basin
+        int get_basin(int k) const { return order[k]; }
+
+        /// \brief Number of cells in a merged basin
+        int get_basin_size(int b) const { return offsets[b + 1] - offsets[b]; }
+
+        /// \brief Pointer to the first cell (index i * size_y + j) of a merged basin
+        const int* get_basin_cells(int b) const { return cells.data() + offsets[b]; }
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include <algorithm>
+#include "raster.h"
+#include "boundary_inflow.h"
+
+
+BoundaryInflow::BoundaryInflow() : scale(1.0) {}
+
+/// Cells are visited in index order so the list comes out sorted. Corner cells
+/// belong to two edges but are only stored once.
+void BoundaryInflow::initialise(Raster& flow) {
+    int size_x = flow.get_size_x();
+    int size_y = flow.get_size_y();
+    cells.clear();
+    base_inflow.clear();
+    for (int i = 0; i < size_x; i++) {
+        bool edge_row = (i == 0 || i == size_x - 1);
+        for (int j = 0; j < size_y; j += (edge_row || j == size_y - 1) ? 1 : size_y - 1) {
+            if (flow(i, j) != 0) {
+                cells.push_back(i * size_y + j);
+                base_inflow.push_back(flow(i, j));
+            }
+        }
+    }
+    inflow = base_inflow;
+    scale = 1.0;
+}
+
+bool BoundaryInflow::set_scale(real_type scale_) {
+    if (scale_ == scale) {
+        return false;
+    }
+    scale = scale_;
+    for (size_t n = 0; n < cells.size(); n++) {
+        inflow[n] = base_inflow[n] * scale;
+    }
+    return true;
+}
+
+int BoundaryInflow::find(int c) const {
+    auto it = std::lower_bound(cells.begin(), cells.end(), c);
+    return (it != cells.end() && *it == c) ? it - cells.begin() : -1;
+}
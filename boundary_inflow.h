@@ -0,0 +1,58 @@
+#ifndef _BOUNDARY_INFLOW_H_
+#define _BOUNDARY_INFLOW_H_
+
+#include <vector>
+#include "raster.h"
+#include "global_defs.h"
+
+/// \brief Flow entering the grid through its outer ring of cells
+///
+/// Only edge cells with non-zero inflow are stored, as (cell, inflow) pairs sorted
+/// by cell index (i * size_y + j), instead of a full Raster that is zero everywhere
+/// but the edges. The inflow can be scaled through time, for example by an
+/// InflowHydrograph.
+class BoundaryInflow {
+    private:
+        std::vector<int> cells;  ///< Edge cells with inflow, in increasing order
+        std::vector<real_type> base_inflow;  ///< Inflow of each cell read from the initial flow Raster
+        std::vector<real_type> inflow;  ///< Inflow of each cell after scaling
+        real_type scale;  ///< Current scale factor applied to base_inflow
+
+    public:
+        /// \brief Create an empty BoundaryInflow object
+        BoundaryInflow();
+
+        /// \brief Take the inflow from the outer ring of cells of a flow Raster
+        /// \param flow The flow accumulation Raster containing the boundary flow values
+        void initialise(Raster& flow);
+
+        /// \brief Scale the inflow read by initialise()
+        /// \param scale_ Scale factor
+        /// \return Whether the scale factor changed
+        bool set_scale(real_type scale_);
+
+        /// \brief Current scale factor
+        real_type get_scale() const { return scale; }
+
+        /// \brief Number of cells with inflow
+        int size() const { return cells.size(); }
+
+        /// \brief Cell index of the n-th cell with inflow
+        int get_cell(int n) const { return cells[n]; }
+
+        /// \brief Inflow of the n-th cell with inflow
+        real_type get_inflow(int n) const { return inflow[n]; }
+
+        /// \brief Position of a cell in the list, or -1 if it has no inflow
+        /// \param c Cell index (i * size_y + j)
+        int find(int c) const;
+
+        /// \brief Inflow of a cell, zero if it has none
+        /// \param c Cell index (i * size_y + j)
+        real_type at(int c) const {
+            int n = find(c);
+            return (n >= 0) ? inflow[n] : 0;
+        }
+};
+
+#endif
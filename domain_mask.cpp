@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstdint>
+#include "Array2D.hpp"
+#include "flood_queue.hpp"
+#include "priority_flood.hpp"
+#include "utility.h"
+#include "domain_mask.h"
+
+
+DomainMask::DomainMask() : full_size_x(0), full_size_y(0), i_min(0), j_min(0), xllcorner(0), yllcorner(0),
+        size_x(0), size_y(0), num_active(0), restricted(false) {}
+
+void DomainMask::initialise(Raster& topo, int outlet_i, int outlet_j) {
+    full_size_x = topo.get_size_x();
+    full_size_y = topo.get_size_y();
+    xllcorner = topo.get_xllcorner();
+    yllcorner = topo.get_yllcorner();
+    frozen.clear();
+    frozen_topo.clear();
+
+    if (outlet_i < 0 || outlet_j < 0) {
+        i_min = 0;
+        j_min = 0;
+        size_x = full_size_x;
+        size_y = full_size_y;
+        num_active = size_x * size_y;
+        restricted = false;
+        active.assign(size_x * size_y, 1);
+        return;
+    }
+    if (outlet_i >= full_size_x || outlet_j >= full_size_y) {
+        Util::Error("Domain outlet is outside the grid", 1);
+    }
+
+    // watershed labels of the flooded DEM, each label drains to one edge cell
+    Array2D<real_type> elevation(full_size_x, full_size_y, -9999.0);
+    elevation.setNoData(topo.get_nodata());
+    for (int i = 0; i < full_size_x; i++) {
+        for (int j = 0; j < full_size_y; j++) {
+            elevation(i, j) = topo(i, j);
+        }
+    }
+    FloodWorkspace<real_type> workspace;
+    Array2D<int32_t> labels;
+    original_priority_flood(elevation, workspace, &labels);
+    int32_t outlet_label = labels(outlet_i, outlet_j);
+    if (outlet_label < 0) {
+        Util::Error("Domain outlet is a nodata cell", 1);
+    }
+
+    // bounding box of the catchment, with a one cell border
+    int i_max = -1;
+    int j_max = -1;
+    i_min = full_size_x;
+    j_min = full_size_y;
+    for (int i = 0; i < full_size_x; i++) {
+        for (int j = 0; j < full_size_y; j++) {
+            if (labels(i, j) == outlet_label) {
+                i_min = std::min(i_min, i);
+                i_max = std::max(i_max, i);
+                j_min = std::min(j_min, j);
+                j_max = std::max(j_max, j);
+            }
+        }
+    }
+    i_min = std::max(i_min - 1, 0);
+    j_min = std::max(j_min - 1, 0);
+    i_max = std::min(i_max + 1, full_size_x - 1);
+    j_max = std::min(j_max + 1, full_size_y - 1);
+    size_x = i_max - i_min + 1;
+    size_y = j_max - j_min + 1;
+    restricted = true;
+
+    num_active = 0;
+    active.assign(size_x * size_y, 0);
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            if (labels(i_min + i, j_min + j) == outlet_label) {
+                active[i * size_y + j] = 1;
+                num_active++;
+            }
+        }
+    }
+
+    frame = topo;
+    frame.set_data(topo.get_nodata());
+}
+
+Raster DomainMask::crop(const Raster& full) const {
+    return full.crop(i_min, j_min, size_x, size_y);
+}
+
+void DomainMask::crop_inflow(Raster& flow) const {
+    for (int i = 0; i < size_x; i++) {
+        bool edge_row = (i == 0 || i == size_x - 1);
+        for (int j = 0; j < size_y; j += (edge_row || j == size_y - 1) ? 1 : size_y - 1) {
+            int fi = i_min + i;
+            int fj = j_min + j;
+            if (fi != 0 && fj != 0 && fi != full_size_x - 1 && fj != full_size_y - 1) {
+                flow(i, j) = 0;
+            }
+        }
+    }
+}
+
+Raster DomainMask::expand(const Raster& window) const {
+    Raster full = frame;
+    full.paste(window, i_min, j_min);
+    return full;
+}
+
+void DomainMask::freeze(const Raster& topo) {
+    frozen.clear();
+    frozen_topo.clear();
+    for (int n = 0; n < size_x * size_y; n++) {
+        if (!active[n]) {
+            frozen.push_back(n);
+            frozen_topo.push_back(topo[n]);
+        }
+    }
+}
+
+void DomainMask::restore(Raster& topo) const {
+    for (size_t n = 0; n < frozen.size(); n++) {
+        topo[frozen[n]] = frozen_topo[n];
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef _DOMAIN_MASK_H_
+#define _DOMAIN_MASK_H_
+
+#include <vector>
+#include "raster.h"
+#include "global_defs.h"
+
+/// \brief Restrict the model to the catchment draining to a chosen outlet
+///
+/// The catchment is found from the watershed labels of a priority flood of the
+/// input DEM: every cell with the same label as the outlet drains to the same
+/// edge cell. The model then runs on the smallest window of the grid holding the
+/// catchment plus one cell around it, so every component (flooding, sorting,
+/// routing, erosion, diffusion, ...) only works on the window. Cells of the window
+/// outside the catchment are frozen at their initial elevations, which keeps the
+/// drainage divide fixed in the same way as the edges of the grid.
+///
+/// Without an outlet the whole grid is the domain and nothing is cropped.
+class DomainMask {
+    private:
+        int full_size_x;  ///< Number of cells in the x dimension of the full grid
+        int full_size_y;  ///< Number of cells in the y dimension of the full grid
+        int i_min;  ///< First index of the window's first row in the full grid
+        int j_min;  ///< Second index of the window's first column in the full grid
+        real_type xllcorner;  ///< x coordinate of the lower left corner of the full grid
+        real_type yllcorner;  ///< y coordinate of the lower left corner of the full grid
+        int size_x;  ///< Number of cells in the x dimension of the window
+        int size_y;  ///< Number of cells in the y dimension of the window
+        int num_active;  ///< Number of cells in the catchment
+        bool restricted;  ///< Whether the domain is smaller than the full grid
+        Raster frame;  ///< Full grid filled with nodata, used to write window rasters at full size
+        std::vector<char> active;  ///< Flags the window cells (index i * size_y + j) in the catchment
+        std::vector<int> frozen;  ///< Window cells outside the catchment
+        std::vector<real_type> frozen_topo;  ///< Elevations the frozen cells are held at
+
+    public:
+        /// \brief Create a DomainMask covering an empty grid
+        DomainMask();
+
+        /// \brief Find the catchment draining to an outlet and the window holding it
+        /// \param topo The Raster of elevations for the full grid
+        /// \param outlet_i First index of the outlet, negative to use the whole grid
+        /// \param outlet_j Second index of the outlet, negative to use the whole grid
+        void initialise(Raster& topo, int outlet_i, int outlet_j);
+
+        /// \brief Copy the window out of a full grid raster
+        Raster crop(const Raster& full) const;
+
+        /// \brief Clear the values on the edges of a cropped flow raster that are not edges of the full grid
+        ///
+        /// The flow router takes the values on the edges of the flow raster as
+        /// boundary inflow; inside the full grid they are only old flow accumulation.
+        void crop_inflow(Raster& flow) const;
+
+        /// \brief Place a window raster into a full grid raster, with nodata outside the window
+        Raster expand(const Raster& window) const;
+
+        /// \brief Store the elevations the cells outside the catchment are held at
+        /// \param topo The Raster of elevations for the window
+        void freeze(const Raster& topo);
+
+        /// \brief Put the cells outside the catchment back to their frozen elevations
+        /// \param topo The Raster of elevations for the window
+        void restore(Raster& topo) const;
+
+        /// \brief Whether the domain is smaller than the full grid
+        bool is_restricted() const { return restricted; }
+
+        /// \brief Whether cell (i, j) of the window is in the catchment
+        bool is_active(int i, int j) const { return active[i * size_y + j] != 0; }
+
+        int get_i_min() const { return i_min; }
+        int get_j_min() const { return j_min; }
+        int get_size_x() const { return size_x; }
+        int get_size_y() const { return size_y; }
+        int get_num_active() const { return num_active; }
+        int get_num_frozen() const { return frozen.size(); }
+        int get_full_size_x() const { return full_size_x; }
+        int get_full_size_y() const { return full_size_y; }
+        real_type get_xllcorner() const { return xllcorner; }
+        real_type get_yllcorner() const { return yllcorner; }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef _FAST_MATH_H_
+#define _FAST_MATH_H_
+
+#include <cstdint>
+#include <cstring>
+
+/// \brief Fast approximations of elementary functions
+///
+/// These avoid calls into libm so that loops using them can be vectorised. They
+/// assume their arguments are in range and do not handle NaN or infinity.
+namespace FastMath {
+
+/// \brief Base 2 logarithm of a positive, normal number
+///
+/// The exponent is taken from the bits of x and the mantissa m is scaled into
+/// [sqrt(1/2), sqrt(2)). log2(m) then comes from the series for atanh in
+/// t = (m - 1) / (m + 1), |t| < 0.172, to the t^11 term: the absolute error is
+/// below 1e-10.
+inline double log2(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    int64_t e = (int64_t)((bits >> 52) & 0x7ff) - 1023;
+    bits = (bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull;
+    double m;
+    std::memcpy(&m, &bits, sizeof(m));
+    const bool high = m > 1.4142135623730951;
+    m = high ? 0.5 * m : m;
+    e += high;
+    double t = (m - 1.0) / (m + 1.0);
+    double t2 = t * t;
+    double series = t * (2.0 + t2 * (2.0 / 3.0 + t2 * (2.0 / 5.0 + t2 * (2.0 / 7.0 + t2 * (2.0 / 9.0 + t2 * (2.0 / 11.0))))));
+    return (double)e + series * 1.4426950408889634;  // series is ln(m)
+}
+
+/// \brief 2 raised to the power y, for -1022 < y < 1024
+///
+/// y is split into an integer n, applied through the exponent bits, and a
+/// remainder f in [-0.5, 0.5]. 2^f = e^(f ln 2) uses the Taylor series to the
+/// 9th power: the relative error is below 1e-10.
+inline double exp2(double y) {
+    // adding and subtracting 1.5 * 2^52 rounds to the nearest integer
+    double n = (y + 6755399441055744.0) - 6755399441055744.0;
+    double u = (y - n) * 0.6931471805599453;
+    double p = 1.0 + u * (1.0 + u * (1.0 / 2 + u * (1.0 / 6 + u * (1.0 / 24 + u * (1.0 / 120 +
+                    u * (1.0 / 720 + u * (1.0 / 5040 + u * (1.0 / 40320 + u * (1.0 / 362880)))))))));
+    uint64_t bits = (uint64_t)((int64_t)n + 1023) << 52;
+    double scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+/// \brief x raised to the power p for x > 0, as exp2(p * log2(x))
+///
+/// The relative error is below 1e-9 as long as |p * log2(x)| stays below about
+/// 100, i.e. for any realistic elevation difference and MFD exponent. Results
+/// that would underflow the double range return 0.
+inline double pow(double x, double p) {
+    double y = p * FastMath::log2(x);
+    return (y > -1022.0) ? FastMath::exp2(y) : 0.0;
+}
+
+}
+
+#endif
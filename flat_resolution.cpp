@@ -0,0 +1,168 @@
+#include <algorithm>
+#include "raster.h"
+#include "utility.h"
+#include "flat_resolution.h"
+
+
+FlatResolution::FlatResolution() : size_x(0), size_y(0), flat_cells(0) {}
+
+void FlatResolution::initialise(Raster& topo) {
+    size_x = topo.get_size_x();
+    size_y = topo.get_size_y();
+    mask.assign(size_x * size_y, 0);
+    labels.assign(size_x * size_y, 0);
+    no_flow.assign(size_x * size_y, 0);
+}
+
+/// Cells on the edge of the DEM drain off the grid, so they are never part of a flat. The
+/// topo Raster is expected to be pit filled (e.g. by original_priority_flood), in which case
+/// every flat drains through at least one low edge; flats without an outlet are left unmasked.
+void FlatResolution::run(Raster& topo) {
+    if (size_x != topo.get_size_x() || size_y != topo.get_size_y()) {
+        Util::Error("Must initialise FlatResolution object", 1);
+    }
+
+    std::fill(mask.begin(), mask.end(), 0);
+    std::fill(labels.begin(), labels.end(), 0);
+    low_edges.clear();
+    high_edges.clear();
+
+    // find cells without a lower neighbour
+    #pragma omp parallel for
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            bool edge = (i == 0) || (j == 0) || (i == size_x - 1) || (j == size_y - 1);
+            bool lower = edge;
+            for (int n = 1; n <= 8 && !lower; n++) {
+                lower = topo(i + dx[n], j + dy[n]) < topo(i, j);
+            }
+            no_flow[i * size_y + j] = !lower;
+        }
+    }
+
+    // find the edges of the flats
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            int c = i * size_y + j;
+            bool low_edge = false;
+            bool high_edge = false;
+            for (int n = 1; n <= 8; n++) {
+                int ni = i + dx[n];
+                int nj = j + dy[n];
+                if ((ni < 0) || (nj < 0) || (ni >= size_x) || (nj >= size_y)) continue;
+                int nc = ni * size_y + nj;
+                if (!no_flow[c] && no_flow[nc] && topo[nc] == topo[c]) {
+                    low_edge = true;
+                }
+                else if (no_flow[c] && topo[nc] > topo[c]) {
+                    high_edge = true;
+                }
+            }
+            if (low_edge) {
+                low_edges.push_back(c);
+            }
+            if (high_edge) {
+                high_edges.push_back(c);
+            }
+        }
+    }
+
+    // label the flats that drain through a low edge
+    int32_t nlabels = 1;
+    for (int c : low_edges) {
+        if (labels[c] == 0) {
+            label_flat(c, nlabels++, topo);
+        }
+    }
+
+    // high edges of flats without an outlet are ignored
+    high_edges.erase(std::remove_if(high_edges.begin(), high_edges.end(),
+                [this](int c) { return labels[c] == 0; }), high_edges.end());
+
+    flat_height.assign(nlabels, 0);
+    away_from_higher();
+    towards_lower();
+
+    flat_cells = 0;
+    for (size_t c = 0; c < mask.size(); c++) {
+        flat_cells += (no_flow[c] && mask[c] > 0);
+    }
+}
+
+void FlatResolution::label_flat(int start, int32_t label, Raster& topo) {
+    real_type z = topo[start];
+    queue.clear();
+    queue.push_back(start);
+    labels[start] = label;
+    for (size_t q = 0; q < queue.size(); q++) {
+        int i = queue[q] / size_y;
+        int j = queue[q] % size_y;
+        for (int n = 1; n <= 8; n++) {
+            int ni = i + dx[n];
+            int nj = j + dy[n];
+            if ((ni < 0) || (nj < 0) || (ni >= size_x) || (nj >= size_y)) continue;
+            int nc = ni * size_y + nj;
+            if (labels[nc] == 0 && topo[nc] == z) {
+                labels[nc] = label;
+                queue.push_back(nc);
+            }
+        }
+    }
+}
+
+/// Flat cells are numbered by their distance (1, 2, ...) from the nearest higher cell, and
+/// flat_height records the largest distance in each flat. Distances are stored negated so the
+/// second search can tell visited cells apart.
+void FlatResolution::away_from_higher() {
+    queue.assign(high_edges.begin(), high_edges.end());
+    for (int c : high_edges) {
+        mask[c] = -1;
+    }
+    for (size_t q = 0; q < queue.size(); q++) {
+        int c = queue[q];
+        int32_t label = labels[c];
+        flat_height[label] = std::max(flat_height[label], -mask[c]);
+        int i = c / size_y;
+        int j = c % size_y;
+        for (int n = 1; n <= 8; n++) {
+            int ni = i + dx[n];
+            int nj = j + dy[n];
+            if ((ni < 0) || (nj < 0) || (ni >= size_x) || (nj >= size_y)) continue;
+            int nc = ni * size_y + nj;
+            if (labels[nc] == label && no_flow[nc] && mask[nc] == 0) {
+                mask[nc] = mask[c] - 1;
+                queue.push_back(nc);
+            }
+        }
+    }
+}
+
+/// Flat cells are numbered by their distance from the low edges; the final mask is twice this
+/// distance plus the away-from-higher gradient (flat_height - distance from higher cells), so
+/// the gradient towards lower terrain dominates.
+void FlatResolution::towards_lower() {
+    queue.assign(low_edges.begin(), low_edges.end());
+    std::vector<int32_t> distance(queue.size(), 1);
+    for (int c : low_edges) {
+        mask[c] = 2;  // low edges have a lower neighbour and are never on the away gradient
+    }
+    for (size_t q = 0; q < queue.size(); q++) {
+        int c = queue[q];
+        int32_t label = labels[c];
+        int32_t d = distance[q];
+        int i = c / size_y;
+        int j = c % size_y;
+        for (int n = 1; n <= 8; n++) {
+            int ni = i + dx[n];
+            int nj = j + dy[n];
+            if ((ni < 0) || (nj < 0) || (ni >= size_x) || (nj >= size_y)) continue;
+            int nc = ni * size_y + nj;
+            if (labels[nc] == label && no_flow[nc] && mask[nc] <= 0) {
+                int32_t away = (mask[nc] < 0) ? flat_height[label] + mask[nc] : 0;
+                mask[nc] = 2 * (d + 1) + away;
+                queue.push_back(nc);
+                distance.push_back(d + 1);
+            }
+        }
+    }
+}
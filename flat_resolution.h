@@ -0,0 +1,62 @@
+#ifndef _FLAT_RESOLUTION_H_
+#define _FLAT_RESOLUTION_H_
+
+#include <vector>
+#include <cstdint>
+#include "raster.h"
+#include "global_defs.h"
+
+/// \brief Drainage directions over flats after Barnes, Lehman and Mulla (2014)
+///
+/// Flats left by pit filling (cells with no lower neighbour) get an integer mask
+/// combining a gradient towards lower terrain and a gradient away from higher
+/// terrain. Flow over a flat follows decreasing mask values, so the flow router
+/// can route across flats without the elevations in topo being altered.
+class FlatResolution {
+    private:
+        int size_x;  ///< Number of cells in the x dimension
+        int size_y;  ///< Number of cells in the y dimension
+        std::vector<int32_t> mask;  ///< Flat mask, 0 for cells not on a drained flat (index i * size_y + j)
+        std::vector<int32_t> labels;  ///< Label of the flat each cell belongs to, 0 if none
+        std::vector<int32_t> flat_height;  ///< Largest away-from-higher distance in each flat
+        std::vector<char> no_flow;  ///< Cells that have no lower neighbour
+        std::vector<int> low_edges;  ///< Cells with a lower neighbour next to a flat cell of equal elevation
+        std::vector<int> high_edges;  ///< Flat cells next to higher cells
+        std::vector<int> queue;  ///< Work queue for the breadth first searches
+        long flat_cells;  ///< Number of cells given a mask in the last run
+
+        /// \brief Label the flat connected to a low edge cell
+        void label_flat(int start, int32_t label, Raster& topo);
+
+        /// \brief Breadth first search from the high edges, storing -distance in mask
+        void away_from_higher();
+
+        /// \brief Breadth first search from the low edges, combining both gradients in mask
+        void towards_lower();
+
+    public:
+        /// \brief Create a FlatResolution object
+        FlatResolution();
+
+        /// \brief Initialise the FlatResolution object
+        /// \param topo The Raster of elevations
+        void initialise(Raster& topo);
+
+        /// \brief Compute the flat mask for the (pit filled) topo Raster
+        /// \param topo The Raster of elevations
+        void run(Raster& topo);
+
+        /// \brief The flat mask, indexed in the same way as the Raster data (i * size_y + j)
+        const std::vector<int32_t>& get_mask() const { return mask; }
+
+        /// \brief Flat mask value for a cell
+        int32_t operator()(int i, int j) const { return mask[i * size_y + j]; }
+
+        /// \brief Label of the flat containing a cell, 0 if none
+        int32_t label(int i, int j) const { return labels[i * size_y + j]; }
+
+        /// \brief Number of cells on drained flats in the last run
+        long get_flat_cells() const { return flat_cells; }
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include "priority_flood.hpp"
 #include "parameters.h"
 #include "flood.h"
@@ -6,18 +7,26 @@
 
 #define fillincrement 0.01
 
-Flood::Flood() : size_x(0), size_y(0), algorithm(2) {}
+Flood::Flood() : size_x(0), size_y(0), algorithm(2), parallel_fill(false), fill_generation(0), incremental(false), track_labels(false), full_flood_interval(1),
+        floods_since_full(0), full_floods(0), incremental_floods(0), cells_reflooded(0) {}
 
 void Flood::initialise(Raster& topo, Parameters& params) {
     size_x = topo.get_size_x();
     size_y = topo.get_size_y();
     algorithm = params.get_flood_algorithm();
+    parallel_fill = params.get_flood_parallel_fill();
+    incremental = params.get_flood_incremental() && algorithm != 0;
+    track_labels = (incremental || params.get_basin_parallel()) && algorithm != 0;
+    full_flood_interval = params.get_full_flood_interval();
+    floods_since_full = 0;
+    flooded.clear();
 
     if (algorithm == 0) {
-        std::cout << "<Flood>: using Pelletier's fillinpitsandflats" << std::endl;
+        std::cout << "<Flood>: using Pelletier's fillinpitsandflats";
+        std::cout << (parallel_fill ? " (parallel wavefronts)" : "") << std::endl;
         elevation = Array2D<real_type>();
     }
-    if (algorithm == 1) {
+    else if (algorithm == 1) {
         std::cout << "<Flood>: using Barnes' original_priority_flood" << std::endl;
         elevation = Array2D<real_type>(size_x, size_y, -9999.0);
     }
@@ -28,6 +37,11 @@ void Flood::initialise(Raster& topo, Parameters& params) {
     else {
         Util::Error("Unrecognised flood algorithm", 1);
     }
+    elevation.setNoData(topo.get_nodata());
+
+    if (incremental) {
+        std::cout << "<Flood>: incremental flooding, full flood every " << full_flood_interval << " floods" << std::endl;
+    }
 }
 
 void Flood::run(Raster& topo, GridNeighbours& nebs) {
@@ -54,12 +68,29 @@ void Flood::run_barnes_flood(Raster& topo) {
 		}
 	}
 
-	// perform flooding
-    if (algorithm == 1) {
-        original_priority_flood(elevation);
+	// perform flooding, either of the whole DEM or only of the basins that changed
+    bool full = !incremental || floods_since_full + 1 >= full_flood_interval || !find_dirty_region();
+    Array2D<int32_t>* flood_labels = track_labels ? &labels : nullptr;
+    if (full) {
+        if (algorithm == 1) {
+            original_priority_flood(elevation, workspace, flood_labels);
+        }
+        else if (algorithm == 2) {
+            priority_flood_epsilon(elevation, workspace, flood_labels);
+        }
+        floods_since_full = 0;
+        full_floods++;
     }
-    else if (algorithm == 2) {
-        priority_flood_epsilon(elevation);
+    else if (!region.empty()) {
+        priority_flood_region(elevation, workspace, region, algorithm == 2, flood_labels);
+        floods_since_full++;
+        incremental_floods++;
+        cells_reflooded += region.size();
+    }
+    else {
+        // nothing changed since the last flood
+        floods_since_full++;
+        incremental_floods++;
     }
 
 	// update topo
@@ -71,9 +102,83 @@ void Flood::run_barnes_flood(Raster& topo) {
 			topo(i, j) = elevation(i, j);     //  Back to original indexing
 		}
 	}
+
+    if (incremental) {
+        record_flood();
+    }
 }
 
-void Flood::fillinpitsandflats(int i, int j, Raster& topo, GridNeighbours& nebs) {
+bool Flood::find_dirty_region() {
+    if (flooded.empty()) {
+        return false;
+    }
+
+    // flag the basins of cells whose elevation changed since the last flood
+    std::fill(dirty_basin.begin(), dirty_basin.end(), 0);
+    for (int j = 0; j < size_y; j++) {
+        for (int i = 0; i < size_x; i++) {
+            if (elevation(i, j) != flooded[j * size_x + i]) {
+                int32_t label = labels(i, j);
+                if (label < 1 || label >= (int32_t) dirty_basin.size()) {
+                    return false;  // not part of any basin, e.g. a no data cell
+                }
+                dirty_basin[label] = 1;
+            }
+        }
+    }
+
+    // gather the cells of the flagged basins, falling back to a full flood if the region is large
+    const size_t max_region = (size_t) size_x * size_y / 2;
+    region.clear();
+    for (size_t label = 1; label < dirty_basin.size(); label++) {
+        if (dirty_basin[label]) {
+            region.insert(region.end(), basin_cells.begin() + basin_offsets[label],
+                    basin_cells.begin() + basin_offsets[label + 1]);
+            if (region.size() > max_region) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Flood::record_flood() {
+    const size_t ncells = (size_t) size_x * size_y;
+    flooded.resize(ncells);
+    for (int j = 0; j < size_y; j++) {
+        for (int i = 0; i < size_x; i++) {
+            flooded[j * size_x + i] = elevation(i, j);
+        }
+    }
+
+    // group cells by label (counting sort); label 0 collects unlabelled cells
+    int32_t nlabels = workspace.next_label;
+    basin_offsets.assign(nlabels + 1, 0);
+    for (int j = 0; j < size_y; j++) {
+        for (int i = 0; i < size_x; i++) {
+            int32_t label = std::max(labels(i, j), 0);
+            basin_offsets[label + 1]++;
+        }
+    }
+    for (int32_t label = 0; label < nlabels; label++) {
+        basin_offsets[label + 1] += basin_offsets[label];
+    }
+    basin_cells.resize(ncells);
+    std::vector<uint32_t> fill(basin_offsets.begin(), basin_offsets.end() - 1);
+    for (int j = 0; j < size_y; j++) {
+        for (int i = 0; i < size_x; i++) {
+            int32_t label = std::max(labels(i, j), 0);
+            basin_cells[fill[label]++] = j * size_x + i;
+        }
+    }
+    dirty_basin.assign(nlabels, 0);
+}
+
+bool Flood::fill_cell(int i, int j, Raster& topo, GridNeighbours& nebs) {
+    if ((i == 0) || (j == 0) || (i == size_x - 1) || (j == size_y - 1)) {
+        return false;
+    }
+
     real_type minv = topo(i, j);
 
     if (topo(nebs.iup(i), j) < minv) minv = topo(nebs.iup(i), j);
@@ -85,25 +190,120 @@ void Flood::fillinpitsandflats(int i, int j, Raster& topo, GridNeighbours& nebs)
     if (topo(nebs.idown(i), nebs.jdown(j)) < minv) minv = topo(nebs.idown(i), nebs.jdown(j));
     if (topo(nebs.iup(i), nebs.jdown(j)) < minv) minv = topo(nebs.iup(i), nebs.jdown(j));
 
-    if ((topo(i, j) <= minv) && (i > 0) && (j > 0) && (i < size_x - 1) && (j < size_y - 1)) {
+    if (topo(i, j) <= minv) {
         topo(i, j) = minv + fillincrement;
-        fillinpitsandflats(i, j, topo, nebs);
-        fillinpitsandflats(nebs.iup(i), j, topo, nebs);
-        fillinpitsandflats(nebs.idown(i), j, topo, nebs);
-        fillinpitsandflats(i, nebs.jup(j), topo, nebs);
-        fillinpitsandflats(i, nebs.jdown(j), topo, nebs);
-        fillinpitsandflats(nebs.iup(i), nebs.jup(j), topo, nebs);
-        fillinpitsandflats(nebs.idown(i), nebs.jup(j), topo, nebs);
-        fillinpitsandflats(nebs.idown(i), nebs.jdown(j), topo, nebs);
-        fillinpitsandflats(nebs.iup(i), nebs.jdown(j), topo, nebs);
+        return true;
     }
+    return false;
+}
+
+/// Pelletier's algorithm used to recurse into the cell and all 8 of its neighbours whenever
+/// it raised a cell, which overflows the stack on large flats. The recursion is replaced by an
+/// explicit stack of pending cells. Neighbours are pushed in reverse so they are popped in the
+/// order the recursive calls were made, giving identical results.
+void Flood::fillinpitsandflats(int i, int j, Raster& topo, GridNeighbours& nebs) {
+    fill_stack.clear();
+    fill_stack.push_back(i * size_y + j);
+
+    while (!fill_stack.empty()) {
+        int ci = fill_stack.back() / size_y;
+        int cj = fill_stack.back() % size_y;
+        fill_stack.pop_back();
 
+        if (fill_cell(ci, cj, topo, nebs)) {
+            fill_stack.push_back(nebs.iup(ci) * size_y + nebs.jdown(cj));
+            fill_stack.push_back(nebs.idown(ci) * size_y + nebs.jdown(cj));
+            fill_stack.push_back(nebs.idown(ci) * size_y + nebs.jup(cj));
+            fill_stack.push_back(nebs.iup(ci) * size_y + nebs.jup(cj));
+            fill_stack.push_back(ci * size_y + nebs.jdown(cj));
+            fill_stack.push_back(ci * size_y + nebs.jup(cj));
+            fill_stack.push_back(nebs.idown(ci) * size_y + cj);
+            fill_stack.push_back(nebs.iup(ci) * size_y + cj);
+            fill_stack.push_back(ci * size_y + cj);
+        }
+    }
 }
 
 void Flood::run_fillinpitsandflats(Raster& topo, GridNeighbours& nebs) {
+    if (parallel_fill) {
+        run_fillinpitsandflats_wavefront(topo, nebs);
+        return;
+    }
+
     for(int i = 0; i < size_x; i++) {
         for(int j = 0; j < size_y; j++) {
             fillinpitsandflats(i, j, topo, nebs);
         }
     }
 }
+
+/// Each wavefront checks a list of cells and queues the neighbours of every raised cell for the
+/// next wavefront; the generation stamp stops a cell being queued twice in one wavefront. Cells
+/// are split into 9 colours by (i % 3, j % 3) so that no two cells of the same colour are
+/// neighbours; the cells of one colour are then independent and are processed in parallel. The
+/// result is deterministic but, since the order differs, not identical to the serial version.
+void Flood::run_fillinpitsandflats_wavefront(Raster& topo, GridNeighbours& nebs) {
+    fill_wave.resize(9);
+    fill_next_wave.resize(9);
+    if ((int) fill_stamp.size() != size_x * size_y) {
+        fill_stamp.assign(size_x * size_y, 0);
+        fill_generation = 0;
+    }
+
+    // the first wavefront checks every interior cell
+    for (int c = 0; c < 9; c++) {
+        fill_wave[c].clear();
+    }
+    for (int i = 1; i < size_x - 1; i++) {
+        for (int j = 1; j < size_y - 1; j++) {
+            fill_wave[(i % 3) * 3 + j % 3].push_back(i * size_y + j);
+        }
+    }
+
+    bool active = true;
+    while (active) {
+        fill_generation++;
+        for (int c = 0; c < 9; c++) {
+            fill_next_wave[c].clear();
+        }
+
+        for (int c = 0; c < 9; c++) {
+            const std::vector<int>& cells = fill_wave[c];
+            fill_stack.clear();  // cells raised in this colour
+
+            #pragma omp parallel
+            {
+                std::vector<int> raised;
+                #pragma omp for schedule(static)
+                for (size_t n = 0; n < cells.size(); n++) {
+                    if (fill_cell(cells[n] / size_y, cells[n] % size_y, topo, nebs)) {
+                        raised.push_back(cells[n]);
+                    }
+                }
+                #pragma omp critical
+                fill_stack.insert(fill_stack.end(), raised.begin(), raised.end());
+            }
+
+            // queue each raised cell and its neighbours for the next wavefront
+            for (int idx : fill_stack) {
+                int ci = idx / size_y;
+                int cj = idx % size_y;
+                for (int n = 0; n <= 8; n++) {
+                    int ni = ci + dx[n];
+                    int nj = cj + dy[n];
+                    if ((ni < 1) || (nj < 1) || (ni > size_x - 2) || (nj > size_y - 2)) continue;
+                    int nidx = ni * size_y + nj;
+                    if (fill_stamp[nidx] == fill_generation) continue;
+                    fill_stamp[nidx] = fill_generation;
+                    fill_next_wave[(ni % 3) * 3 + nj % 3].push_back(nidx);
+                }
+            }
+        }
+
+        std::swap(fill_wave, fill_next_wave);
+        active = false;
+        for (int c = 0; c < 9; c++) {
+            active = active || !fill_wave[c].empty();
+        }
+    }
+}
@@ -6,6 +6,9 @@
 #include "grid_neighbours.h"
 #include "parameters.h"
 #include "Array2D.hpp"
+#include "flood_queue.hpp"
+#include <vector>
+#include <cstdint>
 
 
 class Flood {
@@ -13,17 +16,51 @@ class Flood {
         int size_x;  ///< Number of cells in the x dimension
         int size_y;  ///< Number of cells in the y dimension
         Array2D<real_type> elevation;  ///< Elevation array for passing to Barnes' routines
+        FloodWorkspace<real_type> workspace;  ///< Queues and closed bitmap reused by Barnes' routines
         int algorithm;  ///< Which algorithm to use
+        bool parallel_fill;  ///< Use the wavefront version of Pelletier's algorithm
+        std::vector<int> fill_stack;  ///< Pending cells for fillinpitsandflats (index i * size_y + j)
+        std::vector<int> fill_stamp;  ///< Generation in which each cell was last queued by the wavefront fill
+        int fill_generation;  ///< Current wavefront generation
+        std::vector<std::vector<int> > fill_wave;  ///< Cells to check in the current wavefront, one list per colour
+        std::vector<std::vector<int> > fill_next_wave;  ///< Cells to check in the next wavefront, one list per colour
+        bool incremental;  ///< Only re-flood the basins containing changed cells
+        bool track_labels;  ///< Keep watershed labels up to date on every flood
+        int full_flood_interval;  ///< Run a full flood every this many floods in incremental mode
+        int floods_since_full;  ///< Number of incremental floods since the last full flood
+        Array2D<int32_t> labels;  ///< Watershed labels from the last flood
+        std::vector<real_type> flooded;  ///< Elevations after the last flood (index j * size_x + i)
+        std::vector<uint32_t> basin_offsets;  ///< Start of each basin's cells in basin_cells
+        std::vector<uint32_t> basin_cells;  ///< Cells of every basin, grouped by label
+        std::vector<uint32_t> region;  ///< Cells to re-flood in the current incremental flood
+        std::vector<char> dirty_basin;  ///< Flags the basins containing changed cells
+        unsigned long full_floods;  ///< Number of full floods run
+        unsigned long incremental_floods;  ///< Number of incremental floods run
+        unsigned long cells_reflooded;  ///< Total number of cells in incremental flood regions
 
         /// \brief Run one of Barnes' flood algorithms
         void run_barnes_flood(Raster& topo);
 
+        /// \brief Collect the cells of all basins containing cells changed since the last flood
+        /// \return false if a full flood is needed instead
+        bool find_dirty_region();
+
+        /// \brief Store the flooded elevations and group the cells by watershed label
+        void record_flood();
+
         /// \brief Run Pelletier's algorithm
         void run_fillinpitsandflats(Raster& topo, GridNeighbours& nebs);
 
         /// \brief Do Pelletier's pit filling
         void fillinpitsandflats(int i, int j, Raster& topo, GridNeighbours& nebs);
 
+        /// \brief Run Pelletier's algorithm as a series of parallel wavefronts
+        void run_fillinpitsandflats_wavefront(Raster& topo, GridNeighbours& nebs);
+
+        /// \brief Raise an interior cell above its lowest neighbour if it is not already higher
+        /// \return true if the cell was raised
+        bool fill_cell(int i, int j, Raster& topo, GridNeighbours& nebs);
+
     public:
         /// \brief Create a Flood object
         Flood();
@@ -37,6 +74,21 @@ class Flood {
         /// \param topo The Raster of elevations
         /// \param nebs GridNeighbours instance for neighbour indexing
         void run(Raster& topo, GridNeighbours& nebs);
+
+        /// \brief Watershed labels from the last flood, indexed (i, j); only valid if has_labels()
+        const Array2D<int32_t>& get_labels() const { return labels; }
+
+        /// \brief Whether the flood keeps watershed labels up to date
+        bool has_labels() const { return track_labels; }
+
+        /// \brief Number of full floods run so far
+        unsigned long get_full_floods() const { return full_floods; }
+
+        /// \brief Number of incremental floods run so far
+        unsigned long get_incremental_floods() const { return incremental_floods; }
+
+        /// \brief Total number of cells re-flooded by incremental floods
+        unsigned long get_cells_reflooded() const { return cells_reflooded; }
 };
 
 #endif
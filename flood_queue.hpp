@@ -0,0 +1,261 @@
+#ifndef _FLOOD_QUEUE_HPP_
+#define _FLOOD_QUEUE_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+/// \brief Map elevations onto unsigned integer keys that sort in the same order
+///
+/// Flipping the sign bit of positive values and all bits of negative values gives
+/// keys whose unsigned ordering matches the floating point ordering. NaN is mapped
+/// to the smallest key, which matches the ordering used by grid_cellz, so the heap
+/// comparisons never need to check for NaN.
+template <typename elev_t>
+struct FloodKey;
+
+template <>
+struct FloodKey<float> {
+    typedef uint32_t key_type;
+
+    static key_type encode(float z) {
+        if (std::isnan(z)) {
+            return 0;
+        }
+        uint32_t bits;
+        std::memcpy(&bits, &z, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    }
+};
+
+template <>
+struct FloodKey<double> {
+    typedef uint64_t key_type;
+
+    static key_type encode(double z) {
+        if (std::isnan(z)) {
+            return 0;
+        }
+        uint64_t bits;
+        std::memcpy(&bits, &z, sizeof(bits));
+        return (bits & 0x8000000000000000ull) ? ~bits : (bits | 0x8000000000000000ull);
+    }
+};
+
+
+#pragma pack(push, 4)
+/// \brief Entry in the flood queue: elevation key and linear cell index
+///
+/// Packed to 4 byte alignment so the entry is 8 bytes for float and 12 bytes for double.
+template <typename key_type>
+struct FloodQueueEntry {
+    key_type key;  ///< Ordered elevation key (see FloodKey)
+    uint32_t idx;  ///< Linear index of the cell
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FloodQueueEntry<uint32_t>) == 8, "Unexpected flood queue entry size");
+static_assert(sizeof(FloodQueueEntry<uint64_t>) == 12, "Unexpected flood queue entry size");
+
+
+/// \brief 4-ary min-heap of cells ordered by elevation
+///
+/// The heap storage is kept between uses (clear() does not release memory) so a
+/// queue held by a long lived object does not reallocate on every flood.
+template <typename elev_t>
+class FloodQueue {
+    public:
+        typedef typename FloodKey<elev_t>::key_type key_type;
+        typedef FloodQueueEntry<key_type> entry_type;
+
+    private:
+        std::vector<entry_type> heap;  ///< Heap storage, children of n are 4n+1 ... 4n+4
+
+    public:
+        /// \brief Check whether the queue is empty
+        bool empty() const { return heap.empty(); }
+
+        /// \brief Number of cells in the queue
+        size_t size() const { return heap.size(); }
+
+        /// \brief Remove all cells, keeping the allocated storage
+        void clear() { heap.clear(); }
+
+        /// \brief Reserve storage for the given number of cells
+        void reserve(size_t n) { heap.reserve(n); }
+
+        /// \brief The lowest cell in the queue
+        const entry_type& top() const { return heap.front(); }
+
+        /// \brief Add a cell to the queue
+        /// \param z Elevation of the cell
+        /// \param idx Linear index of the cell
+        void push(elev_t z, uint32_t idx) {
+            entry_type e;
+            e.key = FloodKey<elev_t>::encode(z);
+            e.idx = idx;
+
+            // sift up
+            size_t n = heap.size();
+            heap.push_back(e);
+            while (n > 0) {
+                size_t parent = (n - 1) / 4;
+                if (heap[parent].key <= e.key) {
+                    break;
+                }
+                heap[n] = heap[parent];
+                n = parent;
+            }
+            heap[n] = e;
+        }
+
+        /// \brief Remove the lowest cell from the queue
+        void pop() {
+            entry_type e = heap.back();
+            heap.pop_back();
+            size_t count = heap.size();
+            if (count == 0) {
+                return;
+            }
+
+            // sift down, picking the smallest of the (up to) four children
+            size_t n = 0;
+            while (true) {
+                size_t first = 4 * n + 1;
+                size_t child;
+                if (first + 3 < count) {
+                    size_t a = heap[first + 1].key < heap[first].key ? first + 1 : first;
+                    size_t b = heap[first + 3].key < heap[first + 2].key ? first + 3 : first + 2;
+                    child = heap[b].key < heap[a].key ? b : a;
+                }
+                else if (first < count) {
+                    child = first;
+                    for (size_t m = first + 1; m < count; m++) {
+                        if (heap[m].key < heap[child].key) {
+                            child = m;
+                        }
+                    }
+                }
+                else {
+                    break;
+                }
+                if (e.key <= heap[child].key) {
+                    break;
+                }
+                heap[n] = heap[child];
+                n = child;
+            }
+            heap[n] = e;
+        }
+};
+
+
+/// \brief First-in first-out queue of linear cell indices
+///
+/// Each cell enters the pit queue at most once per flood, so items are appended
+/// to a vector and a read position is advanced instead of using std::queue.
+class FloodFifo {
+    private:
+        std::vector<uint32_t> items;  ///< Queued cell indices
+        size_t head;  ///< Position of the front of the queue in items
+
+    public:
+        /// \brief Create an empty queue
+        FloodFifo() : head(0) {}
+
+        /// \brief Check whether the queue is empty
+        bool empty() const { return head == items.size(); }
+
+        /// \brief Number of cells in the queue
+        size_t size() const { return items.size() - head; }
+
+        /// \brief Remove all cells, keeping the allocated storage
+        void clear() { items.clear(); head = 0; }
+
+        /// \brief Add a cell to the back of the queue
+        void push(uint32_t idx) { items.push_back(idx); }
+
+        /// \brief The cell at the front of the queue
+        uint32_t front() const { return items[head]; }
+
+        /// \brief Remove the cell at the front of the queue
+        void pop() {
+            head++;
+            if (head == items.size()) {
+                clear();
+            }
+        }
+};
+
+
+/// \brief One bit per cell flag array
+class CellBitmap {
+    private:
+        std::vector<uint64_t> words;  ///< Packed flags, 64 cells per word
+        size_t ncells;  ///< Number of cells represented
+
+    public:
+        /// \brief Create an empty bitmap
+        CellBitmap() : ncells(0) {}
+
+        /// \brief Resize the bitmap and clear all flags
+        /// \param n Number of cells
+        void resize(size_t n) {
+            ncells = n;
+            words.assign((n + 63) / 64, 0);
+        }
+
+        /// \brief Number of cells represented by the bitmap
+        size_t size() const { return ncells; }
+
+        /// \brief Clear all flags
+        void clear() { std::fill(words.begin(), words.end(), 0); }
+
+        /// \brief Set all flags
+        void set_all() { std::fill(words.begin(), words.end(), ~uint64_t(0)); }
+
+        /// \brief Check the flag for a cell
+        bool test(size_t idx) const { return (words[idx >> 6] >> (idx & 63)) & 1; }
+
+        /// \brief Set the flag for a cell
+        void set(size_t idx) { words[idx >> 6] |= uint64_t(1) << (idx & 63); }
+
+        /// \brief Clear the flag for a cell
+        void reset(size_t idx) { words[idx >> 6] &= ~(uint64_t(1) << (idx & 63)); }
+};
+
+
+/// \brief Working storage for the priority flood routines
+///
+/// Holding one of these across calls means the queues and the closed bitmap are
+/// only allocated once for a given DEM size.
+template <typename elev_t>
+struct FloodWorkspace {
+    FloodQueue<elev_t> open;  ///< Priority queue of cells with a known path to the edge
+    FloodFifo pit;  ///< Cells being filled within a pit
+    CellBitmap closed;  ///< Cells that have been added to one of the queues
+    std::vector<elev_t*> rows;  ///< Pointers to the start of each row of the elevation grid
+    CellBitmap seeded;  ///< Cells already queued as outlets of a region flood
+    int32_t next_label;  ///< Next free watershed label
+
+    /// \brief Create an empty workspace
+    FloodWorkspace() : next_label(1) {}
+
+    /// \brief Reset the workspace for a DEM with the given number of cells
+    void prepare(size_t ncells) {
+        open.clear();
+        pit.clear();
+        if (closed.size() != ncells) {
+            closed.resize(ncells);
+        }
+        else {
+            closed.clear();
+        }
+    }
+};
+
+#endif
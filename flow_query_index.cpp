@@ -0,0 +1,279 @@
+#include <fstream>
+#include <queue>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <functional>
+#include "utility.h"
+#include "flow_query_index.h"
+
+/// Identifies a saved receiver graph file and its layout
+static const char graph_file_magic[8] = {'T', 'S', 'F', 'G', 'R', 'P', 'H', '2'};
+
+/// Write the contents of a vector to a binary stream
+template <typename T>
+static void write_vector(std::ofstream& fout, const std::vector<T>& values) {
+    fout.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+/// Read a vector of a known size from a binary stream
+template <typename T>
+static void read_vector(std::ifstream& fin, std::vector<T>& values, size_t size) {
+    values.resize(size);
+    fin.read(reinterpret_cast<char*>(values.data()), size * sizeof(T));
+}
+
+
+FlowQueryIndex::FlowQueryIndex() : size_x(0), size_y(0), deltax(1), i_offset(0), j_offset(0),
+        full_size_x(0), full_size_y(0), xllcorner(0), yllcorner(0) {}
+
+void FlowQueryIndex::build(const ReceiverGraph& graph_, int size_x_, int size_y_, real_type deltax_) {
+    if ((int) graph_.offsets.size() != size_x_ * size_y_ + 1 || (int) graph_.order.size() != size_x_ * size_y_) {
+        Util::Error("Receiver graph does not match the grid size of the flow query index", 1);
+    }
+    graph = graph_;
+    size_x = size_x_;
+    size_y = size_y_;
+    deltax = deltax_;
+    i_offset = 0;
+    j_offset = 0;
+    full_size_x = size_x;
+    full_size_y = size_y;
+    xllcorner = 0;
+    yllcorner = 0;
+    build_index();
+}
+
+void FlowQueryIndex::set_window(int i_offset_, int j_offset_, int full_size_x_, int full_size_y_,
+        real_type xllcorner_, real_type yllcorner_) {
+    if (i_offset_ < 0 || j_offset_ < 0 || i_offset_ + size_x > full_size_x_ || j_offset_ + size_y > full_size_y_) {
+        Util::Error("Flow query window is outside the full grid", 1);
+    }
+    i_offset = i_offset_;
+    j_offset = j_offset_;
+    full_size_x = full_size_x_;
+    full_size_y = full_size_y_;
+    xllcorner = xllcorner_;
+    yllcorner = yllcorner_;
+}
+
+void FlowQueryIndex::build_index() {
+    int ncells = size_x * size_y;
+    const std::vector<int>& order = graph.order;
+
+    rank.resize(ncells);
+    for (int n = 0; n < ncells; n++) {
+        rank[order[n]] = n;
+    }
+
+    // dominant receiver, and the donor graph as the transpose of the nonzero edges
+    dominant.assign(ncells, -1);
+    donor_offsets.assign(ncells + 1, 0);
+    for (int c = 0; c < ncells; c++) {
+        real_type best = 0;
+        for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+            if (graph.weights[e] > 0) {
+                donor_offsets[graph.receivers[e] + 1]++;
+                if (graph.weights[e] > best) {
+                    best = graph.weights[e];
+                    dominant[c] = graph.receivers[e];
+                }
+            }
+        }
+    }
+    for (int c = 0; c < ncells; c++) {
+        donor_offsets[c + 1] += donor_offsets[c];
+    }
+    donors.resize(donor_offsets[ncells]);
+    std::vector<int> fill(donor_offsets.begin(), donor_offsets.end() - 1);
+    for (int c = 0; c < ncells; c++) {
+        for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+            if (graph.weights[e] > 0) {
+                donors[fill[graph.receivers[e]]++] = c;
+            }
+        }
+    }
+
+    // size of each dominant subtree; donors come before their receivers in order
+    std::vector<int> subtree(ncells, 1);
+    for (int n = 0; n < ncells; n++) {
+        int c = order[n];
+        if (dominant[c] >= 0) {
+            subtree[dominant[c]] += subtree[c];
+        }
+    }
+
+    // pre-order positions, visiting receivers before their donors: each outlet takes the
+    // next free block of the tour and each donor the next free block within its receiver's
+    tour_start.resize(ncells);
+    tour_end.resize(ncells);
+    outlet.resize(ncells);
+    path_length.resize(ncells);
+    tour.resize(ncells);
+    std::vector<int> next_free(ncells);
+    int next_root = 0;
+    for (int n = ncells - 1; n >= 0; n--) {
+        int c = order[n];
+        int r = dominant[c];
+        if (r < 0) {
+            tour_start[c] = next_root;
+            next_root += subtree[c];
+            outlet[c] = c;
+            path_length[c] = 0;
+        }
+        else {
+            tour_start[c] = next_free[r];
+            next_free[r] += subtree[c];
+            outlet[c] = outlet[r];
+            path_length[c] = path_length[r] + 1;
+        }
+        tour_end[c] = tour_start[c] + subtree[c];
+        next_free[c] = tour_start[c] + 1;
+        tour[tour_start[c]] = c;
+    }
+}
+
+void FlowQueryIndex::save(const std::string& filename) const {
+    std::ofstream fout(filename, std::ios::binary);
+    if (!fout) {
+        Util::Error("Error opening file to save receiver graph: " + filename, 1);
+    }
+
+    int nedges = graph.receivers.size();
+    int value_size = sizeof(real_type);
+    fout.write(graph_file_magic, sizeof(graph_file_magic));
+    fout.write(reinterpret_cast<const char*>(&value_size), sizeof(value_size));
+    fout.write(reinterpret_cast<const char*>(&size_x), sizeof(size_x));
+    fout.write(reinterpret_cast<const char*>(&size_y), sizeof(size_y));
+    fout.write(reinterpret_cast<const char*>(&deltax), sizeof(deltax));
+    fout.write(reinterpret_cast<const char*>(&i_offset), sizeof(i_offset));
+    fout.write(reinterpret_cast<const char*>(&j_offset), sizeof(j_offset));
+    fout.write(reinterpret_cast<const char*>(&full_size_x), sizeof(full_size_x));
+    fout.write(reinterpret_cast<const char*>(&full_size_y), sizeof(full_size_y));
+    fout.write(reinterpret_cast<const char*>(&xllcorner), sizeof(xllcorner));
+    fout.write(reinterpret_cast<const char*>(&yllcorner), sizeof(yllcorner));
+    fout.write(reinterpret_cast<const char*>(&nedges), sizeof(nedges));
+    write_vector(fout, graph.offsets);
+    write_vector(fout, graph.receivers);
+    write_vector(fout, graph.weights);
+    write_vector(fout, graph.order);
+    if (!fout) {
+        Util::Error("Error writing receiver graph: " + filename, 1);
+    }
+}
+
+void FlowQueryIndex::load(const std::string& filename) {
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin) {
+        Util::Error("Missing or invalid receiver graph file: " + filename, 1);
+    }
+
+    char magic[sizeof(graph_file_magic)];
+    int value_size = 0;
+    int nedges = 0;
+    fin.read(magic, sizeof(magic));
+    fin.read(reinterpret_cast<char*>(&value_size), sizeof(value_size));
+    if (!fin || std::memcmp(magic, graph_file_magic, sizeof(magic)) != 0 || value_size != (int) sizeof(real_type)) {
+        Util::Error("Not a receiver graph file, or saved with a different real_type: " + filename, 1);
+    }
+    fin.read(reinterpret_cast<char*>(&size_x), sizeof(size_x));
+    fin.read(reinterpret_cast<char*>(&size_y), sizeof(size_y));
+    fin.read(reinterpret_cast<char*>(&deltax), sizeof(deltax));
+    fin.read(reinterpret_cast<char*>(&i_offset), sizeof(i_offset));
+    fin.read(reinterpret_cast<char*>(&j_offset), sizeof(j_offset));
+    fin.read(reinterpret_cast<char*>(&full_size_x), sizeof(full_size_x));
+    fin.read(reinterpret_cast<char*>(&full_size_y), sizeof(full_size_y));
+    fin.read(reinterpret_cast<char*>(&xllcorner), sizeof(xllcorner));
+    fin.read(reinterpret_cast<char*>(&yllcorner), sizeof(yllcorner));
+    fin.read(reinterpret_cast<char*>(&nedges), sizeof(nedges));
+    if (!fin || size_x < 1 || size_y < 1 || nedges < 0 || i_offset < 0 || j_offset < 0
+            || i_offset + size_x > full_size_x || j_offset + size_y > full_size_y) {
+        Util::Error("Corrupt receiver graph file: " + filename, 1);
+    }
+    int ncells = size_x * size_y;
+    read_vector(fin, graph.offsets, ncells + 1);
+    read_vector(fin, graph.receivers, nedges);
+    read_vector(fin, graph.weights, nedges);
+    read_vector(fin, graph.order, ncells);
+    if (!fin || graph.offsets[ncells] != nedges) {
+        Util::Error("Corrupt receiver graph file: " + filename, 1);
+    }
+
+    build_index();
+}
+
+std::vector<int> FlowQueryIndex::dominant_upstream_cells(int c) const {
+    return std::vector<int>(tour.begin() + tour_start[c], tour.begin() + tour_end[c]);
+}
+
+std::vector<int> FlowQueryIndex::downstream_path(int c) const {
+    std::vector<int> path;
+    path.reserve(path_length[c] + 1);
+    for (; c >= 0; c = dominant[c]) {
+        path.push_back(c);
+    }
+    return path;
+}
+
+std::vector<int> FlowQueryIndex::upstream_cells(const std::vector<int>& cells) const {
+    std::vector<char> visited(size_x * size_y, 0);
+    std::vector<int> found;
+    for (int c : cells) {
+        if (!visited[c]) {
+            visited[c] = 1;
+            found.push_back(c);
+        }
+    }
+
+    // breadth first search over the donor graph, found doubles as the queue
+    for (size_t n = 0; n < found.size(); n++) {
+        int c = found[n];
+        for (int e = donor_offsets[c]; e < donor_offsets[c + 1]; e++) {
+            int d = donors[e];
+            if (!visited[d]) {
+                visited[d] = 1;
+                found.push_back(d);
+            }
+        }
+    }
+    return found;
+}
+
+void FlowQueryIndex::downstream_fractions(const std::vector<int>& cells, std::vector<int>& reached,
+        std::vector<real_type>& fractions) const {
+    reached.clear();
+    fractions.clear();
+    if (cells.empty()) {
+        return;
+    }
+
+    // cells are taken in routing order, so all of a cell's share has arrived before it is passed on
+    std::vector<real_type> share(size_x * size_y, 0);
+    std::vector<char> queued(size_x * size_y, 0);
+    std::priority_queue<int, std::vector<int>, std::greater<int> > queue;
+    real_type source_share = 1.0 / cells.size();
+    for (int c : cells) {
+        share[c] += source_share;
+        if (!queued[c]) {
+            queued[c] = 1;
+            queue.push(rank[c]);
+        }
+    }
+
+    while (!queue.empty()) {
+        int c = graph.order[queue.top()];
+        queue.pop();
+        reached.push_back(c);
+        fractions.push_back(share[c]);
+        for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+            int r = graph.receivers[e];
+            if (graph.weights[e] > 0) {
+                share[r] += share[c] * graph.weights[e];
+                if (!queued[r]) {
+                    queued[r] = 1;
+                    queue.push(rank[r]);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef _FLOW_QUERY_INDEX_H_
+#define _FLOW_QUERY_INDEX_H_
+
+#include <string>
+#include <vector>
+#include "receiver_graph.h"
+#include "global_defs.h"
+
+/// \brief Index over the receiver graph for upstream and downstream queries
+///
+/// Built from the ReceiverGraph of a flow routing, the index holds the reverse
+/// (donor) graph in CSR form and the tree formed by each cell's dominant
+/// receiver, the receiver getting the largest share of its flow. A pre-order
+/// walk of that tree places every cell's dominant upstream area in one range
+/// [tour_start, tour_end) of the walk, so checking whether a cell drains through
+/// another, counting its dominant upstream area, and finding its outlet take
+/// constant time. Queries that follow every receiver rather than the dominant
+/// one (upstream_cells(), downstream_fractions()) only follow the edges of the
+/// cells they return.
+///
+/// Edges with a zero weight (the boundary inflow neighbours of edge cells) are
+/// left out of the index. The graph can be saved to and loaded from a binary
+/// file, so queries can be answered after the model has run.
+///
+/// The graph covers the grid the model ran on, which is a window of the input
+/// grid when the model is restricted to a catchment (see DomainMask). Cells are
+/// indexed within that window; set_window() records where the window sits in the
+/// full grid so cells can be reported in the coordinates of the model's outputs.
+class FlowQueryIndex {
+    private:
+        int size_x;  ///< Number of cells in the x dimension
+        int size_y;  ///< Number of cells in the y dimension
+        real_type deltax;  ///< Width of a cell
+        int i_offset;  ///< First index of the window's first row in the full grid
+        int j_offset;  ///< Second index of the window's first column in the full grid
+        int full_size_x;  ///< Number of cells in the x dimension of the full grid
+        int full_size_y;  ///< Number of cells in the y dimension of the full grid
+        real_type xllcorner;  ///< x coordinate of the lower left corner of the full grid
+        real_type yllcorner;  ///< y coordinate of the lower left corner of the full grid
+        ReceiverGraph graph;  ///< The indexed receiver graph
+        std::vector<int> donor_offsets;  ///< Start of each cell's donors, size is number of cells + 1
+        std::vector<int> donors;  ///< Cells passing flow to each cell
+        std::vector<int> rank;  ///< Position of each cell in graph.order
+        std::vector<int> dominant;  ///< Receiver getting the largest share of each cell's flow, -1 for outlets
+        std::vector<int> tour;  ///< Cells in pre-order of the dominant receiver tree
+        std::vector<int> tour_start;  ///< Position of each cell in tour
+        std::vector<int> tour_end;  ///< One past the last position of each cell's dominant upstream area in tour
+        std::vector<int> outlet;  ///< Outlet reached by following dominant receivers from each cell
+        std::vector<int> path_length;  ///< Number of steps from each cell to its outlet along dominant receivers
+
+        /// \brief Build the donor graph, dominant receiver tree and tour from graph
+        void build_index();
+
+    public:
+        /// \brief Create an empty FlowQueryIndex object
+        FlowQueryIndex();
+
+        /// \brief Build the index from a receiver graph
+        ///
+        /// The grid is taken to be the full grid; call set_window() afterwards if
+        /// it is a window of a larger one.
+        /// \param graph_ Receiver graph from a flow routing, for example FlowRouterBase::get_graph()
+        /// \param size_x_ Number of cells in the x dimension
+        /// \param size_y_ Number of cells in the y dimension
+        /// \param deltax_ Width of a cell
+        void build(const ReceiverGraph& graph_, int size_x_, int size_y_, real_type deltax_);
+
+        /// \brief Place the indexed grid within a larger grid
+        /// \param i_offset_ First index of the window's first row in the full grid
+        /// \param j_offset_ Second index of the window's first column in the full grid
+        /// \param full_size_x_ Number of cells in the x dimension of the full grid
+        /// \param full_size_y_ Number of cells in the y dimension of the full grid
+        /// \param xllcorner_ x coordinate of the lower left corner of the full grid
+        /// \param yllcorner_ y coordinate of the lower left corner of the full grid
+        void set_window(int i_offset_, int j_offset_, int full_size_x_, int full_size_y_,
+                real_type xllcorner_, real_type yllcorner_);
+
+        /// \brief Save the receiver graph to a binary file
+        /// \param filename The name of the file
+        void save(const std::string& filename) const;
+
+        /// \brief Load a receiver graph saved by save() and build the index
+        /// \param filename The name of the file
+        void load(const std::string& filename);
+
+        int get_size_x() const { return size_x; }
+        int get_size_y() const { return size_y; }
+        real_type get_deltax() const { return deltax; }
+        int get_num_cells() const { return size_x * size_y; }
+        int get_i_offset() const { return i_offset; }
+        int get_j_offset() const { return j_offset; }
+        int get_full_size_x() const { return full_size_x; }
+        int get_full_size_y() const { return full_size_y; }
+        real_type get_xllcorner() const { return xllcorner; }
+        real_type get_yllcorner() const { return yllcorner; }
+        const ReceiverGraph& get_graph() const { return graph; }
+
+        /// \brief Linear index of cell (i, j)
+        int index(int i, int j) const { return i * size_y + j; }
+
+        /// \brief Check whether cell (i, j) of the full grid is in the indexed window
+        bool in_window(int i, int j) const {
+            return i >= i_offset && i < i_offset + size_x && j >= j_offset && j < j_offset + size_y;
+        }
+
+        /// \brief Linear index of cell (i, j) of the full grid, which must be in the window
+        int full_to_index(int i, int j) const { return index(i - i_offset, j - j_offset); }
+
+        /// \brief First index of cell c in the full grid
+        int full_i(int c) const { return c / size_y + i_offset; }
+
+        /// \brief Second index of cell c in the full grid
+        int full_j(int c) const { return c % size_y + j_offset; }
+
+        /// \brief Receiver getting the largest share of the flow of cell c (-1 for an outlet)
+        int get_dominant_receiver(int c) const { return dominant[c]; }
+
+        /// \brief Outlet reached from cell c following dominant receivers
+        int get_outlet(int c) const { return outlet[c]; }
+
+        /// \brief Number of steps from cell c to its outlet following dominant receivers
+        int get_path_length(int c) const { return path_length[c]; }
+
+        /// \brief Number of cells (including c) whose dominant path passes through cell c
+        int get_dominant_upstream_count(int c) const { return tour_end[c] - tour_start[c]; }
+
+        /// \brief Area of the cells whose dominant path passes through cell c
+        real_type get_dominant_upstream_area(int c) const { return get_dominant_upstream_count(c) * deltax * deltax; }
+
+        /// \brief Check whether the dominant path from cell a passes through cell b
+        bool drains_through(int a, int b) const { return tour_start[b] <= tour_start[a] && tour_start[a] < tour_end[b]; }
+
+        /// \brief Cells whose dominant path passes through cell c, c first
+        std::vector<int> dominant_upstream_cells(int c) const;
+
+        /// \brief Cells on the dominant path from cell c to its outlet, c first
+        std::vector<int> downstream_path(int c) const;
+
+        /// \brief Cells that pass some of their flow through the given cells, including the cells themselves
+        /// \param cells Cells to find the upstream area of, for example the cells of a slump
+        std::vector<int> upstream_cells(const std::vector<int>& cells) const;
+
+        /// \brief Share of material leaving the given cells that passes through each downstream cell
+        ///
+        /// The source cells start with an equal share each, which is split between
+        /// receivers by the routing weights. Returned cells are in routing order and
+        /// include the sources; the shares of the cells without receivers sum to one.
+        /// \param cells Source cells, for example the cells of a slump
+        /// \param reached Filled with the cells reached
+        /// \param fractions Filled with the share passing through each cell in reached
+        void downstream_fractions(const std::vector<int>& cells, std::vector<int>& reached,
+                std::vector<real_type>& fractions) const;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include "raster.h"
+#include "utility.h"
+#include "flow_router.h"
+#include "parameters.h"
+
+
+template <class Scheme>
+FlowRouter<Scheme>::FlowRouter() :
+        size_x(0), size_y(0) {
+}
+
+template <class Scheme>
+void FlowRouter<Scheme>::initialise(Raster& flow, Parameters& params) {
+    initialise(flow);
+    scheme.initialise(params);
+}
+
+/// Boundary values are taken from the input flow Raster and are applied
+/// during FlowRouter::run() to simulate incoming flow from the outside
+/// the DEM boundaries.
+template <class Scheme>
+void FlowRouter<Scheme>::initialise(Raster& flow) {
+    size_x = flow.get_size_x();
+    size_y = flow.get_size_y();
+
+    // FA boundary values, kept only for edge cells with inflow
+    inflow.initialise(flow);
+}
+
+
+/// The flow Raster gets initialised with the pixel area everywhere and then
+/// the flow accumulation is calculated by proceeding from high to low
+/// elevations. This routine assumes that pit filling and Raster::sort_data()
+/// were called on the topo Raster prior to calling this routine.
+///
+/// If a FlatResolution is given then cells with no lower neighbour pass their
+/// flow to neighbours on the same flat with a lower flat mask, weighted by the
+/// difference in mask. In that case the data must be sorted with the flat mask
+/// as the tiebreak so cells on a flat are visited in decreasing mask order.
+///
+/// The routing is split into building the receiver graph, which is done in
+/// parallel, and accumulating the flow along it in sorted order. The graph is
+/// kept until the next call and is available through get_graph().
+///
+/// Tracers are routed in the same loop as the flow, with the same weights. They
+/// get no boundary inflow.
+template <class Scheme>
+void FlowRouter<Scheme>::run(Raster& topo, Raster& flow, GridNeighbours& nebs, const FlatResolution* flats,
+        TracerSet* tracers) {
+    // make sure initialise was called before proceeding
+    if (topo.get_size_x() != size_x || topo.get_size_y() != size_y) {
+        Util::Error("Must initialise flow router", 1);
+    }
+
+    build_graph(topo, nebs, flats);
+
+    // Note that deltax is not used in this computation, so the flow raster represents simply the number of contributing unit cells upstream.
+    // Initialise flow to ones everywhere
+//    flow.set_data(1.0);
+    // initialise flow with pixel area
+    flow.set_data(topo.get_deltax() * topo.get_deltax());
+
+    // loop over points starting from highest elevation to lowest, picking up the
+    // boundary inflow at the positions found by build_graph()
+    size_t next = 0;
+    for (int t = 0; t < size_x * size_y; t++) {
+        real_type fa = 0;
+        if (next < inflow_positions.size() && inflow_positions[next] == t) {
+            fa = inflow.get_inflow(inflow_entries[next]);
+            next++;
+        }
+        accumulate_cell(graph.order[t], fa, flow, tracers);
+    }
+}
+
+/// Gives the same result as run(); see ParallelFlowAccumulator.
+template <class Scheme>
+void FlowRouter<Scheme>::run_parallel(Raster& topo, Raster& flow, GridNeighbours& nebs, const FlatResolution* flats,
+        TracerSet* tracers) {
+    // make sure initialise was called before proceeding
+    if (topo.get_size_x() != size_x || topo.get_size_y() != size_y) {
+        Util::Error("Must initialise flow router", 1);
+    }
+
+    build_graph(topo, nebs, flats);
+    accumulator.run(graph, inflow, inflow_positions, inflow_entries, topo.get_deltax() * topo.get_deltax(), flow,
+            tracers);
+}
+
+/// Each merged basin is routed from high to low by a single thread, largest basins
+/// first. Watershed labels follow the flood's drainage paths, but MFD also sends flow
+/// to lower neighbours across a basin boundary and boundary inflow goes to all eight
+/// neighbours, so basins joined by an edge of the receiver graph are merged first.
+/// Every cell then only writes to cells of its own merged basin and sees its donors
+/// in the same order as in run(), so the results are identical.
+template <class Scheme>
+void FlowRouter<Scheme>::run_basins(Raster& topo, Raster& flow, GridNeighbours& nebs, const Array2D<int32_t>& labels,
+        const FlatResolution* flats, TracerSet* tracers) {
+    // make sure initialise was called before proceeding
+    if (topo.get_size_x() != size_x || topo.get_size_y() != size_y) {
+        Util::Error("Must initialise flow router", 1);
+    }
+
+    build_graph(topo, nebs, flats);
+
+    basins.reset(labels);
+    for (int c = 0; c < size_x * size_y; c++) {
+        int label = basins.label(c / size_y, c % size_y);
+        for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+            int r = graph.receivers[e];
+            int rlabel = basins.label(r / size_y, r % size_y);
+            if (rlabel != label) {
+                basins.merge(label, rlabel);
+            }
+        }
+    }
+    basins.build(topo, true);
+
+    flow.set_data(topo.get_deltax() * topo.get_deltax());
+
+    // the cells with boundary inflow found by build_graph(), grouped by merged basin; a basin lists
+    // its cells in the same order as graph.order, so each group is in the order its basin visits them
+    basin_inflow.clear();
+    for (size_t k = 0; k < inflow_positions.size(); k++) {
+        int c = graph.order[inflow_positions[k]];
+        basin_inflow.push_back(std::make_pair(basins.find(basins.label(c / size_y, c % size_y)), (int) k));
+    }
+    std::sort(basin_inflow.begin(), basin_inflow.end());
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < basins.get_num_basins(); k++) {
+        int b = basins.get_basin(k);
+        const int* cells = basins.get_basin_cells(b);
+        auto next = std::lower_bound(basin_inflow.begin(), basin_inflow.end(), std::make_pair(b, 0));
+        for (int n = 0; n < basins.get_basin_size(b); n++) {
+            real_type fa = 0;
+            if (next != basin_inflow.end() && next->first == b
+                    && graph.order[inflow_positions[next->second]] == cells[n]) {
+                fa = inflow.get_inflow(inflow_entries[next->second]);
+                ++next;
+            }
+            accumulate_cell(cells[n], fa, flow, tracers);
+        }
+    }
+}
+
+/// The weights of all 8 neighbours of every cell are computed in parallel and the
+/// receivers are counted, the counts are turned into offsets and then the receivers
+/// are packed into the graph, again in parallel. Cells with boundary inflow keep all
+/// eight neighbours, including those with a zero weight, since the inflow is added
+/// to every neighbour.
+template <class Scheme>
+void FlowRouter<Scheme>::build_graph(Raster& topo, GridNeighbours& nebs, const FlatResolution* flats) {
+    int ncells = size_x * size_y;
+    graph.offsets.resize(ncells + 1);
+    graph.offsets[0] = 0;
+    neighbour_weights.resize(8 * ncells);
+
+    #pragma omp parallel for
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            int c = i * size_y + j;
+            real_type* w = &neighbour_weights[8 * c];
+            scheme.weights(i, j, topo, nebs, flats, w);
+            bool edge = (i == 0 || j == 0 || i == size_x - 1 || j == size_y - 1);
+            bool has_inflow = edge && inflow.find(c) >= 0;
+            int count = 0;
+            for (int n = 0; n < 8; n++) {
+                count += (w[n] != 0 || has_inflow);
+            }
+            graph.offsets[c + 1] = count;
+        }
+    }
+    for (int c = 0; c < ncells; c++) {
+        graph.offsets[c + 1] += graph.offsets[c];
+    }
+
+    graph.receivers.resize(graph.offsets[ncells]);
+    graph.weights.resize(graph.offsets[ncells]);
+    #pragma omp parallel for
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            int c = i * size_y + j;
+            const real_type* w = &neighbour_weights[8 * c];
+            bool edge = (i == 0 || j == 0 || i == size_x - 1 || j == size_y - 1);
+            bool has_inflow = edge && inflow.find(c) >= 0;
+            int ni[8] = {nebs.iup(i), nebs.idown(i), i, i, nebs.iup(i), nebs.iup(i), nebs.idown(i), nebs.idown(i)};
+            int nj[8] = {j, j, nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j)};
+            int e = graph.offsets[c];
+            for (int n = 0; n < 8; n++) {
+                if (w[n] != 0 || has_inflow) {
+                    graph.receivers[e] = ni[n] * size_y + nj[n];
+                    graph.weights[e] = w[n];
+                    e++;
+                }
+            }
+        }
+    }
+
+    // cells from high to low
+    graph.order.resize(ncells);
+    #pragma omp parallel for
+    for (int t = 0; t < ncells; t++) {
+        int i, j;
+        topo.get_sorted_ij(ncells - 1 - t, i, j);
+        graph.order[t] = i * size_y + j;
+    }
+
+    // positions of the cells with boundary inflow, so run() can apply it without a lookup per cell
+    inflow_positions.clear();
+    inflow_entries.clear();
+    for (int t = 0; t < ncells; t++) {
+        int i, j;
+        topo.get_sorted_ij(ncells - 1 - t, i, j);
+        if (i == 0 || j == 0 || i == size_x - 1 || j == size_y - 1) {
+            int n = inflow.find(i * size_y + j);
+            if (n >= 0) {
+                inflow_positions.push_back(t);
+                inflow_entries.push_back(n);
+            }
+        }
+    }
+}
+
+/// fa is the boundary inflow of the cell, which is non-zero only for a few edge cells,
+/// so it only costs an addition per receiver for those cells. The cell's own flow is
+/// read for every receiver since, on the edge of the grid, a cell can be its own
+/// neighbour.
+/// Each tracer is a separate contiguous array, so the tracers are passed on one at
+/// a time over the same edges.
+template <class Scheme>
+void FlowRouter<Scheme>::accumulate_cell(int c, real_type fa, Raster& flow, TracerSet* tracers) {
+    int first = graph.offsets[c];
+    int last = graph.offsets[c + 1];
+    if (fa == 0) {
+        for (int e = first; e < last; e++) {
+            flow[graph.receivers[e]] += flow[c] * graph.weights[e];
+        }
+    }
+    else {
+        for (int e = first; e < last; e++) {
+            flow[graph.receivers[e]] += flow[c] * graph.weights[e] + fa;
+        }
+    }
+    if (tracers != nullptr) {
+        accumulate_tracers(c, *tracers);
+    }
+}
+
+template <class Scheme>
+void FlowRouter<Scheme>::accumulate_tracers(int c, TracerSet& tracers) {
+    int first = graph.offsets[c];
+    int last = graph.offsets[c + 1];
+    for (int k = 0; k < tracers.get_num_tracers(); k++) {
+        real_type* t = tracers.tracer(k);
+        for (int e = first; e < last; e++) {
+            t[graph.receivers[e]] += t[c] * graph.weights[e];
+        }
+    }
+}
+
+/// Used when the flow is not routed again (see LazyRouting) but the tracer sources
+/// have changed.
+template <class Scheme>
+void FlowRouter<Scheme>::route_tracers(TracerSet& tracers) {
+    if ((int) graph.order.size() != size_x * size_y || tracers.get_num_cells() != size_x * size_y) {
+        Util::Error("Must route the flow before routing tracers on their own", 1);
+    }
+    for (int c : graph.order) {
+        accumulate_tracers(c, tracers);
+    }
+}
+
+
+template class FlowRouter<MFDScheme>;
+template class FlowRouter<D8Scheme>;
+template class FlowRouter<DInfScheme>;
+
+std::shared_ptr<FlowRouterBase> create_flow_router(const std::string& scheme) {
+    if (scheme == MFDScheme::name()) {
+        return std::make_shared<MFDFlowRouter>();
+    }
+    else if (scheme == D8Scheme::name()) {
+        return std::make_shared<D8FlowRouter>();
+    }
+    else if (scheme == DInfScheme::name()) {
+        return std::make_shared<DInfFlowRouter>();
+    }
+    Util::Error("Unknown flow router: " + scheme, 1);
+    return nullptr;
+}
@@ -0,0 +1,145 @@
+#ifndef _FLOW_ROUTER_H_
+#define _FLOW_ROUTER_H_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+#include "raster.h"
+#include "grid_neighbours.h"
+#include "global_defs.h"
+#include "parameters.h"
+#include "flat_resolution.h"
+#include "basin_decomposition.h"
+#include "Array2D.hpp"
+#include "receiver_graph.h"
+#include "parallel_flow_accumulator.h"
+#include "tracer_set.h"
+#include "boundary_inflow.h"
+#include "flow_schemes.h"
+
+/// \brief Interface of the flow routers, whatever their partition scheme
+class FlowRouterBase {
+    public:
+        virtual ~FlowRouterBase() {}
+
+        /// \brief Name of the partition scheme, as used for [flow] router
+        virtual const char* get_scheme_name() const = 0;
+
+        /// \brief Initialise the router
+        /// \param flow The flow accumulation Raster containing the initial (boundary) flow values
+        virtual void initialise(Raster& flow) = 0;
+
+        /// \brief Initialise the router with settings from the parameters
+        /// \param flow The flow accumulation Raster containing the initial (boundary) flow values
+        /// \param params Parameters object
+        virtual void initialise(Raster& flow, Parameters& params) = 0;
+
+        /// \brief Do the flow routing
+        /// \param topo The Raster of elevations
+        /// \param flow The flow accumulation Raster that will contain the output flow values
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        /// \param flats Optional flat mask used to route flow across flats
+        /// \param tracers Optional tracers holding the amount generated in each cell, routed in the same pass
+        virtual void run(Raster& topo, Raster& flow, GridNeighbours& nebs, const FlatResolution* flats = nullptr,
+                TracerSet* tracers = nullptr) = 0;
+
+        /// \brief Do the flow routing with the parallel donor counting accumulator
+        /// \param topo The Raster of elevations
+        /// \param flow The flow accumulation Raster that will contain the output flow values
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        /// \param flats Optional flat mask used to route flow across flats
+        /// \param tracers Optional tracers holding the amount generated in each cell, routed in the same pass
+        virtual void run_parallel(Raster& topo, Raster& flow, GridNeighbours& nebs,
+                const FlatResolution* flats = nullptr, TracerSet* tracers = nullptr) = 0;
+
+        /// \brief Do the flow routing, routing independent basins in parallel
+        /// \param topo The Raster of elevations
+        /// \param flow The flow accumulation Raster that will contain the output flow values
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        /// \param labels Watershed labels from the flood (see Flood::get_labels())
+        /// \param flats Optional flat mask used to route flow across flats
+        /// \param tracers Optional tracers holding the amount generated in each cell, routed in the same pass
+        virtual void run_basins(Raster& topo, Raster& flow, GridNeighbours& nebs, const Array2D<int32_t>& labels,
+                const FlatResolution* flats = nullptr, TracerSet* tracers = nullptr) = 0;
+
+        /// \brief Route tracers along the receiver graph of the last routing, leaving the flow as it is
+        /// \param tracers Tracers holding the amount generated in each cell
+        virtual void route_tracers(TracerSet& tracers) = 0;
+
+        /// \brief Scale the boundary inflow taken from the initial flow Raster
+        /// \param scale Scale factor, for example from an InflowHydrograph
+        /// \return Whether the inflow changed
+        virtual bool set_inflow_scale(real_type scale) = 0;
+
+        /// \brief The boundary inflow
+        virtual const BoundaryInflow& get_inflow() const = 0;
+
+        /// \brief The receiver graph built by the last routing
+        virtual const ReceiverGraph& get_graph() const = 0;
+
+        /// \brief Number of independent basins in the last call to run_basins()
+        virtual int get_num_basins() const = 0;
+};
+
+
+/// \brief Flow routing with a partition scheme chosen at compile time
+///
+/// Ordering, boundary inflow, the receiver graph and the serial, parallel and
+/// basin by basin accumulation are shared by all schemes; the Scheme (see
+/// flow_schemes.h) only gives the weights of each cell's 8 neighbours. The
+/// member functions are instantiated in flow_router.cpp for MFDScheme, D8Scheme
+/// and DInfScheme.
+template <class Scheme>
+class FlowRouter : public FlowRouterBase {
+    private:
+        int size_x;  ///< Number of cells in the x dimension
+        int size_y;  ///< Number of cells in the y dimension
+        Scheme scheme;  ///< Partition scheme
+        BoundaryInflow inflow;  ///< Flow coming in at the boundaries
+        std::vector<int> inflow_positions;  ///< Positions in graph.order of the cells with inflow, in increasing order
+        std::vector<int> inflow_entries;  ///< Entry in inflow of each of inflow_positions
+        BasinDecomposition basins;  ///< Basins routed independently by run_basins()
+        std::vector<std::pair<int, int> > basin_inflow;  ///< Merged basin and inflow_positions entry of each inflow cell
+        ReceiverGraph graph;  ///< Receivers and weights of every cell from the last run
+        ParallelFlowAccumulator accumulator;  ///< Donor counting accumulator used by run_parallel()
+        std::vector<real_type> neighbour_weights;  ///< Weights of all 8 neighbours of every cell, used while building the graph
+
+        /// \brief Build the receiver graph for the current topo
+        void build_graph(Raster& topo, GridNeighbours& nebs, const FlatResolution* flats);
+
+        /// \brief Pass the flow and tracers of one cell (index i * size_y + j), with boundary inflow fa, on to its receivers
+        void accumulate_cell(int c, real_type fa, Raster& flow, TracerSet* tracers);
+
+        /// \brief Pass the tracers of one cell on to its receivers
+        void accumulate_tracers(int c, TracerSet& tracers);
+
+    public:
+        /// \brief Create a FlowRouter object
+        FlowRouter();
+
+        const char* get_scheme_name() const { return Scheme::name(); }
+        void initialise(Raster& flow);
+        void initialise(Raster& flow, Parameters& params);
+        void run(Raster& topo, Raster& flow, GridNeighbours& nebs, const FlatResolution* flats = nullptr,
+                TracerSet* tracers = nullptr);
+        void run_parallel(Raster& topo, Raster& flow, GridNeighbours& nebs, const FlatResolution* flats = nullptr,
+                TracerSet* tracers = nullptr);
+        void run_basins(Raster& topo, Raster& flow, GridNeighbours& nebs, const Array2D<int32_t>& labels,
+                const FlatResolution* flats = nullptr, TracerSet* tracers = nullptr);
+        void route_tracers(TracerSet& tracers);
+        bool set_inflow_scale(real_type scale) { return inflow.set_scale(scale); }
+        const BoundaryInflow& get_inflow() const { return inflow; }
+        const ReceiverGraph& get_graph() const { return graph; }
+        int get_num_basins() const { return basins.get_num_basins(); }
+};
+
+typedef FlowRouter<MFDScheme> MFDFlowRouter;
+typedef FlowRouter<D8Scheme> D8FlowRouter;
+typedef FlowRouter<DInfScheme> DInfFlowRouter;
+
+/// \brief Create a router for the scheme named by [flow] router
+/// \param scheme "mfd", "d8" or "dinf"
+std::shared_ptr<FlowRouterBase> create_flow_router(const std::string& scheme);
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef _FLOW_SCHEMES_H_
+#define _FLOW_SCHEMES_H_
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include "raster.h"
+#include "grid_neighbours.h"
+#include "flat_resolution.h"
+#include "parameters.h"
+#include "fast_math.h"
+#include "global_defs.h"
+
+/// \brief Partition schemes for FlowRouter
+///
+/// A scheme computes the fraction of a cell's flow passed to each of its 8
+/// neighbours, in the order iup, idown, jup, jdown, (iup, jup), (iup, jdown),
+/// (idown, jup), (idown, jdown). Every scheme provides
+/// \code
+/// static const char* name();
+/// void initialise(Parameters& params);
+/// void weights(int i, int j, Raster& topo, GridNeighbours& nebs, const FlatResolution* flats, real_type* w) const;
+/// \endcode
+/// and FlowRouter is instantiated once per scheme, so weights() is inlined into
+/// the graph building loop.
+namespace FlowSchemes {
+
+/// Distance factor of each neighbour, 1/sqrt(2) on the diagonals
+static const real_type neighbour_scale[8] = {1.0, 1.0, 1.0, 1.0, oneoversqrt2, oneoversqrt2, oneoversqrt2, oneoversqrt2};
+
+/// \brief Drop in elevation from cell (i, j) to each of its neighbours
+inline void neighbour_drops(int i, int j, Raster& topo, GridNeighbours& nebs, real_type* dz) {
+    const real_type z = topo(i, j);
+    dz[0] = z - topo(nebs.iup(i), j);
+    dz[1] = z - topo(nebs.idown(i), j);
+    dz[2] = z - topo(i, nebs.jup(j));
+    dz[3] = z - topo(i, nebs.jdown(j));
+    dz[4] = z - topo(nebs.iup(i), nebs.jup(j));
+    dz[5] = z - topo(nebs.iup(i), nebs.jdown(j));
+    dz[6] = z - topo(nebs.idown(i), nebs.jup(j));
+    dz[7] = z - topo(nebs.idown(i), nebs.jdown(j));
+}
+
+/// \brief Unnormalised weights for a cell with no lower neighbour, following the flat mask
+///
+/// Neighbours on the same flat with a lower mask get the difference in mask,
+/// scaled by distance. Returns the total weight added.
+inline real_type flat_weights(int i, int j, GridNeighbours& nebs, const FlatResolution& flats, real_type* w) {
+    real_type tot = 0;
+    int32_t label = flats.label(i, j);
+    int32_t m = flats(i, j);
+    int ni[8] = {nebs.iup(i), nebs.idown(i), i, i, nebs.iup(i), nebs.iup(i), nebs.idown(i), nebs.idown(i)};
+    int nj[8] = {j, j, nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j), nebs.jup(j), nebs.jdown(j)};
+    for (int n = 0; n < 8; n++) {
+        if (flats.label(ni[n], nj[n]) == label && flats(ni[n], nj[n]) < m) {
+            w[n] = (m - flats(ni[n], nj[n])) * neighbour_scale[n];
+            tot += w[n];
+        }
+    }
+    return tot;
+}
+
+/// \brief Pass everything to the neighbour with the largest weight (the first one on ties)
+inline void select_largest(real_type* w) {
+    int best = 0;
+    for (int n = 1; n < 8; n++) {
+        if (w[n] > w[best]) {
+            best = n;
+        }
+    }
+    bool any = w[best] > 0;
+    for (int n = 0; n < 8; n++) {
+        w[n] = 0;
+    }
+    w[best] = any ? 1 : 0;
+}
+
+}
+
+
+/// \brief Multiple flow direction: every lower neighbour gets a share
+///
+/// Each weight is the drop to the neighbour (scaled by 1/sqrt(2) on the
+/// diagonals) raised to [flow] mfd_exponent, normalised by the total. The loop
+/// over the 8 neighbours has no branches in fast_pow mode so it can be
+/// vectorised; the exact mode keeps std::pow for regression tests.
+struct MFDScheme {
+    double exponent;  ///< Exponent applied to the drop to each neighbour
+    bool fast_pow;  ///< Use FastMath::pow instead of std::pow
+
+    MFDScheme() : exponent(1.1), fast_pow(false) {}
+
+    static const char* name() { return "mfd"; }
+
+    void initialise(Parameters& params) {
+        exponent = params.get_mfd_exponent();
+        fast_pow = params.get_fast_pow();
+        if (fast_pow) {
+            std::cout << "<FlowRouter>: using fast pow approximation" << std::endl;
+        }
+    }
+
+    void weights(int i, int j, Raster& topo, GridNeighbours& nebs, const FlatResolution* flats, real_type* w) const {
+        const real_type* scale = FlowSchemes::neighbour_scale;
+        real_type dz[8];
+        FlowSchemes::neighbour_drops(i, j, topo, nebs, dz);
+
+        if (fast_pow) {
+            for (int n = 0; n < 8; n++) {
+                real_type drop = std::max(dz[n] * scale[n], (real_type) 1e-30);
+                real_type weight = FastMath::pow(drop, exponent);
+                w[n] = (dz[n] > 0) ? weight : 0;
+            }
+        }
+        else {
+            for (int n = 0; n < 8; n++) {
+                w[n] = (dz[n] > 0) ? pow(dz[n] * scale[n], exponent) : 0;
+            }
+        }
+
+        real_type tot = 0;
+        for (int n = 0; n < 8; n++) {
+            tot += w[n];
+        }
+
+        if (tot == 0 && flats != nullptr && (*flats)(i, j) > 0) {
+            // no downslope neighbour: follow the flat mask instead
+            tot += FlowSchemes::flat_weights(i, j, nebs, *flats, w);
+        }
+
+        if (tot != 0) {
+            real_type reciptot = 1.0 / tot;
+            for (int n = 0; n < 8; n++) {
+                w[n] *= reciptot;
+            }
+        }
+    }
+};
+
+
+/// \brief D8 (O'Callaghan and Mark, 1984): all flow goes to the steepest lower neighbour
+struct D8Scheme {
+    static const char* name() { return "d8"; }
+
+    void initialise(Parameters& params) {}
+
+    void weights(int i, int j, Raster& topo, GridNeighbours& nebs, const FlatResolution* flats, real_type* w) const {
+        real_type dz[8];
+        FlowSchemes::neighbour_drops(i, j, topo, nebs, dz);
+        real_type tot = 0;
+        for (int n = 0; n < 8; n++) {
+            w[n] = std::max(dz[n] * FlowSchemes::neighbour_scale[n], (real_type) 0);
+            tot += w[n];
+        }
+        if (tot == 0 && flats != nullptr && (*flats)(i, j) > 0) {
+            FlowSchemes::flat_weights(i, j, nebs, *flats, w);
+        }
+        FlowSchemes::select_largest(w);
+    }
+};
+
+
+/// \brief D-infinity (Tarboton, 1997): flow follows the steepest downslope direction
+///
+/// The steepest direction is found over the 8 triangular facets formed by the
+/// cell, a cardinal neighbour and the diagonal neighbour next to it. Its flow is
+/// split between the two neighbours of the facet in proportion to how close the
+/// direction is to each of them.
+struct DInfScheme {
+    static const char* name() { return "dinf"; }
+
+    void initialise(Parameters& params) {}
+
+    void weights(int i, int j, Raster& topo, GridNeighbours& nebs, const FlatResolution* flats, real_type* w) const {
+        // facets as (cardinal, diagonal) neighbour pairs, going round the cell
+        static const int cardinal[8] = {0, 2, 2, 1, 1, 3, 3, 0};
+        static const int diagonal[8] = {4, 4, 6, 6, 7, 7, 5, 5};
+        const real_type quarter_pi = std::atan(real_type(1));
+
+        real_type dz[8];
+        FlowSchemes::neighbour_drops(i, j, topo, nebs, dz);
+        for (int n = 0; n < 8; n++) {
+            w[n] = 0;
+        }
+
+        // steepest facet, slopes in units of the cell size. Squared slopes are compared
+        // and the angle is only worked out for the steepest facet.
+        int best = -1;
+        int best_side = 0;
+        real_type best_slope2 = 0;
+        real_type best_s1 = 0;
+        real_type best_s2 = 0;
+        for (int f = 0; f < 8; f++) {
+            real_type s1 = dz[cardinal[f]];
+            real_type s2 = dz[diagonal[f]] - dz[cardinal[f]];
+            real_type slope2;
+            int side;  // -1 along the cardinal edge, 1 along the diagonal edge, 0 inside the facet
+            if (s2 < 0) {
+                slope2 = (s1 > 0) ? s1 * s1 : 0;
+                side = -1;
+            }
+            else if (s2 > s1) {
+                real_type s = dz[diagonal[f]] * oneoversqrt2;
+                slope2 = (s > 0) ? s * s : 0;
+                side = 1;
+            }
+            else {
+                slope2 = s1 * s1 + s2 * s2;
+                side = 0;
+            }
+            if (slope2 > best_slope2) {
+                best = f;
+                best_side = side;
+                best_slope2 = slope2;
+                best_s1 = s1;
+                best_s2 = s2;
+            }
+        }
+
+        if (best >= 0) {
+            real_type angle = (best_side < 0) ? 0 : (best_side > 0) ? quarter_pi : std::atan2(best_s2, best_s1);
+            real_type fraction = angle / quarter_pi;
+            w[cardinal[best]] += 1 - fraction;
+            w[diagonal[best]] += fraction;
+        }
+        else if (flats != nullptr && (*flats)(i, j) > 0) {
+            FlowSchemes::flat_weights(i, j, nebs, *flats, w);
+            FlowSchemes::select_largest(w);
+        }
+    }
+};
+
+#endif
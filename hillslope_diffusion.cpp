@@ -1,34 +1,63 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include "raster.h"
 #include "grid_neighbours.h"
 #include "parameters.h"
 #include "global_defs.h"
 #include "utility.h"
+#include "tridiagonal_solver.h"
+#include "multigrid_diffusion.h"
 #include "hillslope_diffusion.h"
 
-HillSlopeDiffusion::HillSlopeDiffusion() : lattice_size_x(0), lattice_size_y(0) {}
+HillSlopeDiffusion::HillSlopeDiffusion() : lattice_size_x(0), lattice_size_y(0), min_change(0), max_iterations(5),
+        multigrid(false), nonlinear(false), critical_slope(1.25), nonlinear_iterations(10), bytes_moved(0),
+        batched(false), line_solver("thomas"), nthreads(1), max_n(0) {}
 
 
 void HillSlopeDiffusion::initialise(Raster& topo, Parameters& params) {
     lattice_size_x = topo.get_size_x();
     lattice_size_y = topo.get_size_y();
 
-    topoold = Raster(lattice_size_x, lattice_size_y);
-    ax = real_vector(lattice_size_x);
-    bx = real_vector(lattice_size_x);
-    cx = real_vector(lattice_size_x);
+    iteration_counts.clear();
+    bytes_moved = 0;
     ux = real_vector(lattice_size_x);
-    rx = real_vector(lattice_size_x);
-    ay = real_vector(lattice_size_y);
-    by = real_vector(lattice_size_y);
-    cy = real_vector(lattice_size_y);
     uy = real_vector(lattice_size_y);
-    ry = real_vector(lattice_size_y);
+    gamx = real_vector(lattice_size_x);
+    gamy = real_vector(lattice_size_y);
+    coefficients = real_vector(4 * std::max(lattice_size_x, lattice_size_y));
+
+    batched = params.get_diffusion_batched();
+    if (batched) {
+        nthreads = omp_get_max_threads();
+        max_n = std::max(lattice_size_x, lattice_size_y);
+        workspace = real_vector(nthreads * 6 * max_n * batch_size);
+        line_solver = params.get_diffusion_line_solver();
+        if (line_solver != "thomas") {
+            pcr_workspace = real_vector(13 * max_n);
+        }
+    }
 
     D = params.get_D();
     deltax2 = topo.get_deltax() * topo.get_deltax();
     ann_timestep = params.get_ann_timestep();
     thresholdarea = params.get_thresholdarea();
+    min_change = params.get_diffusion_min_change();
+    max_iterations = params.get_diffusion_max_iterations();
+
+    multigrid = params.get_diffusion_solver() == "multigrid";
+    nonlinear = params.get_diffusion_transport() == "nonlinear";
+    critical_slope = params.get_critical_slope();
+    nonlinear_iterations = params.get_nonlinear_iterations();
+    if (multigrid || nonlinear) {
+        multigrid_solver.initialise(lattice_size_x, lattice_size_y);
+        diffusivity = Raster(lattice_size_x, lattice_size_y, D);
+        fixed.assign(lattice_size_x * lattice_size_y, 0);
+    }
+    if (nonlinear) {
+        old_topo = Raster(lattice_size_x, lattice_size_y, 0.0);
+        transport_diffusivity = Raster(lattice_size_x, lattice_size_y, D);
+    }
 }
 
 
@@ -36,112 +65,319 @@ void HillSlopeDiffusion::run(Raster& topo, Raster& flow, GridNeighbours& nebs) {
     if (lattice_size_x != topo.get_size_x() || lattice_size_y != topo.get_size_y()) {
         Util::Error("Must initialise HillSlopeDiffusion object", 1);
     }
+    bytes_moved = 0;
+    if (nonlinear) {
+        run_nonlinear(topo, flow);
+        return;
+    }
+    if (multigrid) {
+        run_multigrid(topo, flow);
+        return;
+    }
+    if (batched) {
+        run_batched(topo, flow, nebs);
+        return;
+    }
 
-	int count = 0;
-	while (count < 5)
-	{
-		count++;
-        #pragma omp parallel for
-		for (int i = 0; i < lattice_size_x; i++)
-			for (int j = 0; j < lattice_size_y; j++)
-				topoold(i, j) = topo(i, j);
-		for (int i = 0; i < lattice_size_x; i++)
-		{
-            #pragma omp parallel for
-			for (int j = 0; j < lattice_size_y; j++)
-			{
-				real_type term1 = D * ann_timestep / (deltax2);
-				if (flow(i, j) < thresholdarea)
-				{
-					ay[j] = -term1;
-					cy[j] = -term1;
-					by[j] = 4 * term1 + 1;
-					ry[j] = term1 * ( topo(nebs.iup(i), j) + topo(nebs.idown(i), j) ) + topoold(i, j);
-				}
-				else
-				{
-					by[j] = 1;
-					ay[j] = 0;
-					cy[j] = 0;
-					ry[j] = topoold(i, j);
-				}
-				if (j == 0)
-				{
-					by[j] = 1;
-					cy[j] = 0;
-					ry[j] = topoold(i, j);
-				}
-				if (j == lattice_size_y-1)
-				{
-					by[j] = 1;
-					ay[j] = 0;
-					ry[j] = topoold(i, j);
-				}
-			}
-			tridag(ay, by, cy, ry, uy, lattice_size_y);
-            #pragma omp parallel for
-			for (int j = 0; j < lattice_size_y; j++)
-				topo(i, j) = uy[j];
-		}
+    // a line's own elevations are not changed until it is solved, so they are the old elevations;
+    // with more than one thread each line is built and written back in parallel
+    bool split = omp_get_max_threads() > 1;
+    int count = 0;
+    real_type change = 0;
+    do {
+        count++;
+        change = 0;
+        for (int i = 0; i < lattice_size_x; i++) {
+            change = std::max(change, split ? split_line(topo, flow, nebs, true, i, uy, gamy)
+                    : solve_line(topo, flow, nebs, true, i, uy, gamy));
+        }
+        for (int j = 0; j < lattice_size_y; j++) {
+            change = std::max(change, split ? split_line(topo, flow, nebs, false, j, ux, gamx)
+                    : solve_line(topo, flow, nebs, false, j, ux, gamx));
+        }
+    } while (count < max_iterations && change >= min_change);
+    record_iterations(count);
+    // each sweep reads the elevations and flow and writes the elevations
+    bytes_moved += 2.0 * count * 3 * lattice_size_x * lattice_size_y * sizeof(real_type);
+}
+
+/// Edge cells and cells at or above the threshold flow area keep their elevation;
+/// the rest are implicit in the line and explicit across it, with the neighbouring
+/// lines as they are when this line is solved.
+void HillSlopeDiffusion::equation(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int line, int k, int n,
+        real_type term1, real_type& a, real_type& b, real_type& c, real_type& r) const {
+    int i = rows ? line : k;
+    int j = rows ? k : line;
+    if (k == 0 || k == n - 1 || flow(i, j) >= thresholdarea) {
+        a = 0;
+        b = 1;
+        c = 0;
+        r = topo(i, j);
+    }
+    else {
+        real_type across = rows ? topo(nebs.iup(i), j) + topo(nebs.idown(i), j)
+                : topo(i, nebs.jup(j)) + topo(i, nebs.jdown(j));
+        a = -term1;
+        c = -term1;
+        b = 4 * term1 + 1;
+        r = term1 * across + topo(i, j);
+    }
+}
+
+/// The Thomas algorithm, as Tridiagonal::solve_batch() for one line, with each
+/// equation built as the forward elimination reaches it and each elevation written
+/// back as the back substitution reaches it, so the coefficients are never stored
+/// and the line is only read and written once.
+real_type HillSlopeDiffusion::solve_line(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int line,
+        real_vector& u, real_vector& gam) {
+    int n = rows ? lattice_size_y : lattice_size_x;
+    real_type term1 = D * ann_timestep / deltax2;
+    real_type a, b, c, r;
+    equation(topo, flow, nebs, rows, line, 0, n, term1, a, b, c, r);
+    gam[0] = c / b;
+    u[0] = r / b;
+    for (int k = 1; k < n; k++) {
+        equation(topo, flow, nebs, rows, line, k, n, term1, a, b, c, r);
+        real_type bet = b - a * gam[k - 1];
+        gam[k] = c / bet;
+        u[k] = (r - a * u[k - 1]) / bet;
+    }
+
+    real_type change = 0;
+    for (int k = n - 1; k >= 0; k--) {
+        if (k < n - 1) {
+            u[k] -= gam[k] * u[k + 1];
+        }
+        real_type& h = topo(rows ? line : k, rows ? k : line);
+        change = std::max<real_type>(change, std::abs(u[k] - h));
+        h = u[k];
+    }
+    return change;
+}
+
+/// The same arithmetic as solve_line(), so the result does not depend on the number
+/// of threads.
+real_type HillSlopeDiffusion::split_line(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int line,
+        real_vector& u, real_vector& gam) {
+    int n = rows ? lattice_size_y : lattice_size_x;
+    real_type term1 = D * ann_timestep / deltax2;
+    real_type* a = &coefficients[0];
+    real_type* b = a + n;
+    real_type* c = b + n;
+    real_type* r = c + n;
+    #pragma omp parallel for
+    for (int k = 0; k < n; k++) {
+        equation(topo, flow, nebs, rows, line, k, n, term1, a[k], b[k], c[k], r[k]);
+    }
+
+    gam[0] = c[0] / b[0];
+    u[0] = r[0] / b[0];
+    for (int k = 1; k < n; k++) {
+        real_type bet = b[k] - a[k] * gam[k - 1];
+        gam[k] = c[k] / bet;
+        u[k] = (r[k] - a[k] * u[k - 1]) / bet;
+    }
+    for (int k = n - 2; k >= 0; k--) {
+        u[k] -= gam[k] * u[k + 1];
+    }
+
+    real_type change = 0;
+    #pragma omp parallel for reduction(max: change)
+    for (int k = 0; k < n; k++) {
+        real_type& h = topo(rows ? line : k, rows ? k : line);
+        change = std::max<real_type>(change, std::abs(u[k] - h));
+        h = u[k];
+    }
+    return change;
+}
+
+/// Rows and columns are swept as in run(), but each sweep is split into the even
+/// lines and then the odd lines (zebra ordering). The lines of one colour only read
+/// their neighbours of the other colour, so they are independent and are solved in
+/// batches of batch_size lines by Tridiagonal::solve_batch(), one batch per thread
+/// at a time. In run() each line sees the update of the line before it; here the
+/// even lines see no updates and the odd lines see both of their neighbours
+/// updated, so the result is slightly different but does not depend on the number
+/// of threads. Each line's own elevations are not changed until it is solved, so
+/// no copy of the old elevations is needed.
+void HillSlopeDiffusion::run_batched(Raster& topo, Raster& flow, GridNeighbours& nebs) {
+    // the number of threads may have changed since initialise(), and sweep_lines() gives each its own workspace
+    nthreads = omp_get_max_threads();
+    workspace.resize(nthreads * 6 * max_n * batch_size);
+
+    int count = 0;
+    real_type change = 0;
+    do {
+        count++;
+        change = sweep_lines(topo, flow, nebs, true, 0);
+        change = std::max(change, sweep_lines(topo, flow, nebs, true, 1));
+        change = std::max(change, sweep_lines(topo, flow, nebs, false, 0));
+        change = std::max(change, sweep_lines(topo, flow, nebs, false, 1));
+    } while (count < max_iterations && change >= min_change);
+    record_iterations(count);
+    // each of the four passes reads all the elevations, and the flow and writes the elevations of half the lines
+    bytes_moved += 4.0 * count * 2 * lattice_size_x * lattice_size_y * sizeof(real_type);
+}
+
+/// Edge cells and cells at or above the threshold flow area keep their elevation, as
+/// in the ADI sweeps.
+void HillSlopeDiffusion::mark_fixed(Raster& flow) {
+    #pragma omp parallel for
+    for (int i = 0; i < lattice_size_x; i++) {
+        for (int j = 0; j < lattice_size_y; j++) {
+            bool edge = (i == 0 || j == 0 || i == lattice_size_x - 1 || j == lattice_size_y - 1);
+            fixed[i * lattice_size_y + j] = edge || flow(i, j) >= thresholdarea;
+        }
+    }
+    bytes_moved += (double) lattice_size_x * lattice_size_y * (sizeof(real_type) + sizeof(char));
+}
+
+/// V-cycles stand in for the ADI iterations.
+void HillSlopeDiffusion::run_multigrid(Raster& topo, Raster& flow) {
+    mark_fixed(flow);
+    int cycles = multigrid_solver.solve(topo, diffusivity, fixed, ann_timestep, min_change, max_iterations);
+    record_iterations(cycles);
+    bytes_moved += multigrid_solver.get_bytes_moved();
+}
+
+/// Critical slope transport (Roering et al., 1999) has the flux
+///
+///     q = -D grad h / (1 - (|grad h| / Sc)^2)
+///
+/// which is diffusion with the diffusivity of each cell scaled by
+/// 1 / (1 - (S / Sc)^2), taking S as the steepest slope to the cell's four
+/// neighbours. Each Picard iteration lags that scaling at the last iterate and
+/// solves the backward Euler step from the old elevations with the multigrid
+/// solver, so each iterate is bounded by the old elevations whatever the
+/// timestep. S / Sc is limited to max_slope_ratio, where the flux would otherwise
+/// be unbounded, which keeps the scaling finite on near vertical ice faces.
+void HillSlopeDiffusion::run_nonlinear(Raster& topo, Raster& flow) {
+    mark_fixed(flow);
+    old_topo = topo;
+    bytes_moved += 2.0 * lattice_size_x * lattice_size_y * sizeof(real_type);
+    real_type deltax = std::sqrt(deltax2);
+    int count = 0;
+    real_type change = 0;
+    do {
+        count++;
         #pragma omp parallel for
-		for (int i = 0; i < lattice_size_x; i++)
-			for (int j = 0; j < lattice_size_y; j++)
-				topoold(i, j) = topo(i, j);
-		for (int j = 0; j < lattice_size_y; j++)
-		{
-            #pragma omp parallel for
-			for (int i = 0; i < lattice_size_x; i++)
-			{
-				real_type term1 = D * ann_timestep / ( deltax2 );
-				if (flow(i, j) < thresholdarea)
-				{
-					ax[i] = -term1;
-					cx[i] = -term1;
-					bx[i] = 4 * term1 + 1;
-					rx[i] = term1 * ( topo(i, nebs.jup(j)) + topo(i, nebs.jdown(j)) ) + topoold(i, j);
-				}
-				else
-				{
-					bx[i] = 1;
-					ax[i] = 0;
-					cx[i] = 0;
-					rx[i] = topoold(i, j);
-				}
-				if (i == 0)
-				{
-					bx[i] = 1;
-					cx[i] = 0;
-					rx[i] = topoold(i, j);
-				}
-				if (i == lattice_size_x-1)
-				{
-					bx[i] = 1;
-					ax[i] = 0;
-					rx[i] = topoold(i, j);
-				}
-			}
-			tridag(ax, bx, cx, rx, ux, lattice_size_x);
-            #pragma omp parallel for
-			for (int i = 0; i < lattice_size_x; i++)
-				topo(i, j) = ux[i];
-		}
-	}
+        for (int i = 0; i < lattice_size_x; i++) {
+            for (int j = 0; j < lattice_size_y; j++) {
+                const int di[4] = {-1, 1, 0, 0};
+                const int dj[4] = {0, 0, -1, 1};
+                real_type drop = 0;
+                for (int n = 0; n < 4; n++) {
+                    int ni = i + di[n];
+                    int nj = j + dj[n];
+                    if (ni >= 0 && nj >= 0 && ni < lattice_size_x && nj < lattice_size_y) {
+                        drop = std::max<real_type>(drop, std::abs(topo(i, j) - topo(ni, nj)));
+                    }
+                }
+                real_type ratio = std::min<real_type>(drop / deltax / critical_slope, max_slope_ratio);
+                transport_diffusivity(i, j) = diffusivity(i, j) / (1 - ratio * ratio);
+            }
+        }
+        multigrid_solver.solve(topo, old_topo, transport_diffusivity, fixed, ann_timestep, min_change, max_iterations);
+        change = multigrid_solver.get_change();
+        // the transport factor reads the elevations and diffusivity and writes the scaled diffusivity
+        bytes_moved += multigrid_solver.get_bytes_moved() + 3.0 * lattice_size_x * lattice_size_y * sizeof(real_type);
+    } while (count < nonlinear_iterations && change >= min_change);
+    record_iterations(count);
+}
+
+void HillSlopeDiffusion::record_iterations(int count) {
+    if ((int) iteration_counts.size() <= count) {
+        iteration_counts.resize(count + 1, 0);
+    }
+    iteration_counts[count]++;
 }
 
-void HillSlopeDiffusion::tridag(real_vector& a, real_vector& b, real_vector& c, real_vector& r, real_vector& u, int n) {
-	unsigned long j;
-	real_type bet;
-	real_vector gam(n);
-
-	u[0] = r[0] / (bet = b[0]);
-	for (j = 1; j < n; j++)
-	{
-		gam[j] = c[j - 1] / bet;
-		bet = b[j] - a[j] * gam[j];
-		u[j] = (r[j] - a[j] * u[j - 1]) / bet;
-	}
-	for (j = (n-2); j > 1; j--)
-	{
-		u[j] -= gam[j + 1] * u[j + 1];
-	}
+/// Each line is solved by the Thomas algorithm, in batches of lines spread over the
+/// threads, unless use_pcr() picks parallel cyclic reduction. Then the lines are
+/// solved one after another, each with all the threads, which keeps the threads
+/// busy when a narrow grid has only a few long lines.
+real_type HillSlopeDiffusion::sweep_lines(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int parity) {
+    int nlines = ((rows ? lattice_size_x : lattice_size_y) - parity + 1) / 2;
+    int n = rows ? lattice_size_y : lattice_size_x;
+    real_type term1 = D * ann_timestep / deltax2;
+    real_type change = 0;
+
+    // coefficients of equation k of a line, stored at w
+    auto coefficients = [&](real_type* a, real_type* b, real_type* c, real_type* r, int line, int k, int w) {
+        equation(topo, flow, nebs, rows, line, k, n, term1, a[w], b[w], c[w], r[w]);
+    };
+
+    if (use_pcr(nlines)) {
+        real_type* a = &pcr_workspace[0];
+        real_type* b = a + n;
+        real_type* c = b + n;
+        real_type* r = c + n;
+        real_type* u = r + n;
+        for (int l = 0; l < nlines; l++) {
+            int line = parity + 2 * l;
+            #pragma omp parallel for
+            for (int k = 0; k < n; k++) {
+                coefficients(a, b, c, r, line, k, k);
+            }
+            Tridiagonal::solve_pcr(a, b, c, r, u, u + n, n);
+            #pragma omp parallel for reduction(max: change)
+            for (int k = 0; k < n; k++) {
+                real_type& h = topo(rows ? line : k, rows ? k : line);
+                change = std::max<real_type>(change, std::abs(u[k] - h));
+                h = u[k];
+            }
+        }
+        return change;
+    }
+
+    int nbatches = (nlines + batch_size - 1) / batch_size;
+    #pragma omp parallel for schedule(static) reduction(max: change)
+    for (int batch = 0; batch < nbatches; batch++) {
+        real_type* a = &workspace[omp_get_thread_num() * 6 * max_n * batch_size];
+        real_type* b = a + max_n * batch_size;
+        real_type* c = b + max_n * batch_size;
+        real_type* r = c + max_n * batch_size;
+        real_type* u = r + max_n * batch_size;
+        real_type* gam = u + max_n * batch_size;
+        int first = batch * batch_size;
+        int count = std::min(batch_size, nlines - first);
+
+        // one line per lane, visiting topo in memory order
+        if (rows) {
+            for (int l = 0; l < count; l++) {
+                for (int k = 0; k < n; k++) {
+                    coefficients(a, b, c, r, parity + 2 * (first + l), k, k * batch_size + l);
+                }
+            }
+        }
+        else {
+            for (int k = 0; k < n; k++) {
+                for (int l = 0; l < count; l++) {
+                    coefficients(a, b, c, r, parity + 2 * (first + l), k, k * batch_size + l);
+                }
+            }
+        }
+
+        Tridiagonal::solve_batch(a, b, c, r, u, gam, n, count, batch_size);
+
+        if (rows) {
+            for (int l = 0; l < count; l++) {
+                for (int k = 0; k < n; k++) {
+                    real_type& h = topo(parity + 2 * (first + l), k);
+                    change = std::max<real_type>(change, std::abs(u[k * batch_size + l] - h));
+                    h = u[k * batch_size + l];
+                }
+            }
+        }
+        else {
+            for (int k = 0; k < n; k++) {
+                for (int l = 0; l < count; l++) {
+                    real_type& h = topo(k, parity + 2 * (first + l));
+                    change = std::max<real_type>(change, std::abs(u[k * batch_size + l] - h));
+                    h = u[k * batch_size + l];
+                }
+            }
+        }
+    }
+    return change;
 }
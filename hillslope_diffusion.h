@@ -5,31 +5,94 @@
 #include "grid_neighbours.h"
 #include "parameters.h"
 #include "global_defs.h"
+#include "multigrid_diffusion.h"
+#include <string>
+#include <vector>
 
+/// \brief Implicit hillslope diffusion by alternating direction line solves
 class HillSlopeDiffusion {
     private:
-        Raster topoold;  ///< Raster containing old elevations
         int lattice_size_x;   ///< x dimension
         int lattice_size_y;   ///< y dimension
         real_type D;   ///< Diffusion rate
         real_type deltax2;   ///< Pixel size squared
         real_type ann_timestep;   ///< Time step in years
         real_type thresholdarea;
-        real_vector ax;
-        real_vector ay;
-        real_vector bx;
-        real_vector by;
-        real_vector cx;
-        real_vector cy;
-        real_vector ux;
-        real_vector uy;
-        real_vector rx;
-        real_vector ry;
-
-        /// \brief Solve a tridiagonal system
-        void tridag(real_vector& a, real_vector& b, real_vector& c, real_vector& r, real_vector& u, int n);
+        real_type min_change;  ///< Stop early once no elevation changes by this much (m) in an iteration
+        int max_iterations;  ///< Largest number of ADI iterations in each call to run()
+        bool multigrid;  ///< Solve each time step with the multigrid solver, which allows a variable diffusivity
+        MultigridDiffusion multigrid_solver;
+        Raster diffusivity;  ///< Diffusivity of each cell for the multigrid solver
+        std::vector<char> fixed;  ///< Cells the multigrid solver keeps at their elevation
+        bool nonlinear;  ///< Critical slope transport, solved by Picard iterations of the multigrid solver
+        real_type critical_slope;  ///< Slope at which nonlinear transport becomes unbounded
+        int nonlinear_iterations;  ///< Largest number of Picard iterations in each call to run()
+        Raster old_topo;  ///< Elevations at the start of the time step, for the Picard iterations
+        Raster transport_diffusivity;  ///< Diffusivity of each cell scaled by the nonlinear transport factor
+        std::vector<long> iteration_counts;  ///< Number of calls to run() that took each number of iterations
+        real_vector ux;  ///< Solution along a column
+        real_vector uy;  ///< Solution along a row
+        real_vector gamx;  ///< Thomas algorithm workspace along a column
+        real_vector gamy;  ///< Thomas algorithm workspace along a row
+        real_vector coefficients;  ///< Equations of one line, four arrays of the longest line, for split_line()
+        double bytes_moved;  ///< Bytes of grids read and written by the last call to run()
+        bool batched;  ///< Solve the lines of each sweep in parallel batches, see run_batched()
+        std::string line_solver;  ///< Batched line solver: thomas, pcr, or auto (pcr when there are fewer lines than threads, unvalidated)
+        real_vector pcr_workspace;  ///< Coefficients, solution and scratch for one line solved by cyclic reduction
+        int nthreads;  ///< Number of threads sharing workspace
+        int max_n;  ///< Length of the longest line
+        real_vector workspace;  ///< Coefficients, solution and scratch for a batch of lines, for each thread
+
+        /// \brief Coefficients of equation k of a row (rows = true) or column of n cells
+        void equation(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int line, int k, int n,
+                real_type term1, real_type& a, real_type& b, real_type& c, real_type& r) const;
+
+        /// \brief Build, solve and write back the equations of one row (rows = true) or column
+        /// \param u Workspace for the solution, at least as long as the line
+        /// \param gam Workspace for the Thomas algorithm, at least as long as the line
+        /// \return The largest change in elevation
+        real_type solve_line(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int line, real_vector& u,
+                real_vector& gam);
+
+        /// \brief As solve_line(), but building and writing back the line in parallel
+        ///
+        /// The equations are stored in coefficients so they can be built by all the
+        /// threads before the serial Thomas algorithm; the result is the same as
+        /// solve_line()'s.
+        real_type split_line(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int line, real_vector& u,
+                real_vector& gam);
+
+        /// \brief Flag the edges and the cells at or above the threshold area as fixed for the multigrid solver
+        void mark_fixed(Raster& flow);
+
+        /// \brief Diffuse for one time step with the multigrid solver
+        void run_multigrid(Raster& topo, Raster& flow);
+
+        /// \brief Nonlinear transport for one time step by Picard iterations of the multigrid solver
+        void run_nonlinear(Raster& topo, Raster& flow);
+
+        /// \brief Count a call to run() that took this many iterations
+        void record_iterations(int count);
+
+        /// \brief Diffuse along every other row (rows = true) or column, in parallel batches of lines
+        /// \param topo Elevations Raster
+        /// \param flow Flow accumulation Raster
+        /// \param nebs Neighbour indexing object
+        /// \param rows Solve along rows (lines of constant i) rather than columns
+        /// \param parity Solve the even (0) or odd (1) lines
+        /// \return The largest change in elevation
+        real_type sweep_lines(Raster& topo, Raster& flow, GridNeighbours& nebs, bool rows, int parity);
+
+        /// \brief Whether a sweep over this many lines uses parallel cyclic reduction
+        bool use_pcr(int nlines) const { return line_solver == "pcr" || (line_solver == "auto" && nlines < nthreads); }
+
+        /// \brief Run the ADI iterations with batched, zebra ordered line solves
+        void run_batched(Raster& topo, Raster& flow, GridNeighbours& nebs);
 
     public:
+        static const int batch_size = 16;  ///< Number of lines solved together by each thread
+        static constexpr real_type max_slope_ratio = 0.99;  ///< Slopes steeper than this fraction of the critical slope are limited to it
+
         /// \brief Create HillSlopeDiffusion object
         HillSlopeDiffusion();
 
@@ -39,10 +102,34 @@ class HillSlopeDiffusion {
         void initialise(Raster& topo, Parameters& params);
 
         /// \brief Run the HillSlopeDiffusion algorithm
+        ///
+        /// ADI iterations (a row sweep then a column sweep) are repeated until no
+        /// elevation changes by min_change or more in an iteration, or until
+        /// max_iterations, both from the [diffusion] parameters. Each iteration starts
+        /// from the elevations the last one left, so it is another implicit step rather
+        /// than a correction towards one step's solution. min_change is an early stop
+        /// on the change per iteration, not a residual, and stopping early diffuses
+        /// less in the call. With the multigrid solver, V-cycles solve the one step
+        /// and are repeated until its largest residual (m) is below min_change. With
+        /// nonlinear transport, Picard iterations are repeated until no elevation
+        /// changes by min_change, or until nonlinear_iterations.
         /// \param topo Elevations Raster
         /// \param flow Flow accumulation Raster
         /// \param nebs Neighbour indexing object
         void run(Raster& topo, Raster& flow, GridNeighbours& nebs);
+
+        /// \brief Diffusivity of each cell, D everywhere unless changed; only used by the multigrid solver and nonlinear transport
+        Raster& get_diffusivity() { return diffusivity; }
+
+        /// \brief Bytes of grids read and written by the last call to run()
+        ///
+        /// Counts each grid sized array once per pass over it, as if neighbouring
+        /// lines stay in cache, which is the least traffic the pass can take.
+        double get_bytes_moved() const { return bytes_moved; }
+
+        /// \brief Number of calls to run() since initialise() that took each number of ADI iterations, V-cycles or
+        /// Picard iterations
+        const std::vector<long>& get_iteration_counts() const { return iteration_counts; }
 };
 
 #endif
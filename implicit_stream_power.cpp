@@ -0,0 +1,115 @@
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "global_defs.h"
+#include "implicit_stream_power.h"
+
+
+ImplicitStreamPower::ImplicitStreamPower() : size_x(0), size_y(0) {}
+
+void ImplicitStreamPower::initialise(Raster& topo) {
+    size_x = topo.get_size_x();
+    size_y = topo.get_size_y();
+    int ncells = size_x * size_y;
+    receiver.resize(ncells);
+    distance.resize(ncells);
+    donor_offsets.resize(ncells + 1);
+    donors.resize(ncells);
+    stack.resize(ncells);
+}
+
+void ImplicitStreamPower::build_stack(const Raster& topo, const GridNeighbours& nebs, real_type deltax) {
+    int ncells = size_x * size_y;
+
+    // steepest lower neighbour of each interior cell
+    #pragma omp parallel for
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            int c = i * size_y + j;
+            receiver[c] = c;
+            distance[c] = deltax;
+            if (i == 0 || j == 0 || i == size_x - 1 || j == size_y - 1) {
+                continue;
+            }
+            int iu = nebs.iup(i);
+            int id = nebs.idown(i);
+            int ju = nebs.jup(j);
+            int jd = nebs.jdown(j);
+            const int ni[8] = {iu, id, i, i, iu, iu, id, id};
+            const int nj[8] = {j, j, ju, jd, ju, jd, ju, jd};
+            real_type h = topo[c];
+            real_type steepest = 0;
+            for (int n = 0; n < 8; n++) {
+                real_type length = (n < 4) ? deltax : deltax * sqrt2;
+                real_type s = (h - topo(ni[n], nj[n])) / length;
+                if (s > steepest) {
+                    steepest = s;
+                    receiver[c] = ni[n] * size_y + nj[n];
+                    distance[c] = length;
+                }
+            }
+        }
+    }
+
+    // donors of each cell in CSR form
+    std::fill(donor_offsets.begin(), donor_offsets.end(), 0);
+    for (int c = 0; c < ncells; c++) {
+        if (receiver[c] != c) {
+            donor_offsets[receiver[c] + 1]++;
+        }
+    }
+    for (int c = 0; c < ncells; c++) {
+        donor_offsets[c + 1] += donor_offsets[c];
+    }
+    // stack holds the next free slot of each cell's donors until the donors are filled in
+    std::copy(donor_offsets.begin(), donor_offsets.end() - 1, stack.begin());
+    for (int c = 0; c < ncells; c++) {
+        if (receiver[c] != c) {
+            donors[stack[receiver[c]]++] = c;
+        }
+    }
+
+    // base levels first, then the donors of the cells already in the stack
+    int top = 0;
+    for (int c = 0; c < ncells; c++) {
+        if (receiver[c] == c) {
+            stack[top++] = c;
+        }
+    }
+    for (int n = 0; n < top; n++) {
+        int c = stack[n];
+        for (int d = donor_offsets[c]; d < donor_offsets[c + 1]; d++) {
+            stack[top++] = donors[d];
+        }
+    }
+}
+
+real_type ImplicitStreamPower::run(Raster& topo, Raster& flow, Raster& eroded, real_type K, real_type timestep,
+        GridNeighbours& nebs) {
+    real_type deltax = topo.get_deltax();
+    real_type deltax2 = deltax * deltax;
+    build_stack(topo, nebs, deltax);
+
+    real_type maxe = 0;
+    for (int n = 0; n < size_x * size_y; n++) {
+        int c = stack[n];
+        int r = receiver[c];
+        if (r == c) {
+            eroded[c] = 0;
+            continue;
+        }
+        real_type coefficient = K * sqrt(flow[c] / 1e6) * deltax;
+        real_type f = timestep * coefficient / distance[c];
+        real_type old_topo = topo[c];
+        topo[c] = (old_topo + f * topo[r]) / (1 + f);
+        if (topo[c] < 0) {
+            topo[c] = 0;
+        }
+        eroded[c] = (old_topo - topo[c]) * deltax2;
+        if (coefficient > maxe) {
+            maxe = coefficient;
+        }
+    }
+
+    return maxe;
+}
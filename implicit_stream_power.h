@@ -0,0 +1,60 @@
+#ifndef _IMPLICIT_STREAM_POWER_H_
+#define _IMPLICIT_STREAM_POWER_H_
+
+#include <vector>
+#include "raster.h"
+#include "grid_neighbours.h"
+#include "global_defs.h"
+
+/// \brief Implicit channel erosion along steepest descent receivers (Braun and Willett, 2013)
+///
+/// Each interior cell passes its erosion on to its steepest lower neighbour, the
+/// receiver. Cells are visited from base level upstream (the receiver stack), so a
+/// cell is always solved after its receiver has been updated. With the slope taken
+/// as (h - h_receiver) / distance, the stream power law
+/// dh/dt = -K sqrt(A / 1e6) deltax slope is then a single linear equation per cell:
+///
+///     h = (h_old + F h_receiver) / (1 + F),  F = dt K sqrt(A / 1e6) deltax / distance
+///
+/// A cell can never be lowered below its receiver, whatever the timestep, and
+/// each step is O(N). Edge cells and cells without a lower neighbour are base
+/// levels and are not eroded.
+class ImplicitStreamPower {
+    private:
+        int size_x;  ///< Number of cells in the x dimension
+        int size_y;  ///< Number of cells in the y dimension
+        std::vector<int> receiver;  ///< Steepest lower neighbour of each cell, the cell itself for base levels
+        std::vector<real_type> distance;  ///< Distance from each cell to its receiver
+        std::vector<int> donor_offsets;  ///< Start of each cell's donors, size is number of cells + 1
+        std::vector<int> donors;  ///< Cells whose receiver is each cell
+        std::vector<int> stack;  ///< Cells ordered from base level upstream
+
+        /// \brief Find the receivers of all cells and order them from base level upstream
+        void build_stack(const Raster& topo, const GridNeighbours& nebs, real_type deltax);
+
+    public:
+        /// \brief Create an ImplicitStreamPower object
+        ImplicitStreamPower();
+
+        /// \brief Initialise the ImplicitStreamPower object
+        /// \param topo The Raster of elevations
+        void initialise(Raster& topo);
+
+        /// \brief Erode the channels for one timestep
+        /// \param topo The Raster of elevations, updated in place (flooded, so interior cells drain)
+        /// \param flow The Raster of flow accumulation
+        /// \param eroded Set to the volume removed from each cell
+        /// \param K Stream power erodibility, yr^-1
+        /// \param timestep Time step in years
+        /// \param nebs GridNeighbours instance for neighbour indexing
+        /// \return The largest erosion coefficient K sqrt(A / 1e6) deltax, as for the explicit update
+        real_type run(Raster& topo, Raster& flow, Raster& eroded, real_type K, real_type timestep, GridNeighbours& nebs);
+
+        /// \brief Receiver of a cell (index i * size_y + j) in the last run
+        int get_receiver(int c) const { return receiver[c]; }
+
+        /// \brief Cells in the order they were solved in the last run
+        const std::vector<int>& get_stack() const { return stack; }
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "utility.h"
+#include "inflow_hydrograph.h"
+
+
+InflowHydrograph::InflowHydrograph() {}
+
+void InflowHydrograph::load(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        Util::Error("Cannot open inflow hydrograph: " + filename, 1);
+    }
+
+    times.clear();
+    scales.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream row(line);
+        real_type day, hour, scale;
+        if (!(row >> day >> hour >> scale)) {
+            if (times.empty() && scales.empty() && line.find_first_of("0123456789") == std::string::npos) {
+                continue;  // header
+            }
+            Util::Error("Cannot read inflow hydrograph line: " + line, 1);
+        }
+        real_type time = day + hour / 24;
+        if (!times.empty() && time <= times.back()) {
+            Util::Error("Inflow hydrograph times must be increasing: " + line, 1);
+        }
+        times.push_back(time);
+        scales.push_back(scale);
+    }
+    if (times.empty()) {
+        Util::Error("No rows in inflow hydrograph: " + filename, 1);
+    }
+}
+
+real_type InflowHydrograph::scale(int day, int hour) const {
+    if (times.empty()) {
+        return 1.0;
+    }
+    real_type time = day + hour / real_type(24);
+    if (time <= times.front()) {
+        return scales.front();
+    }
+    if (time >= times.back()) {
+        return scales.back();
+    }
+    size_t n = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+    real_type f = (time - times[n - 1]) / (times[n] - times[n - 1]);
+    return scales[n - 1] + f * (scales[n] - scales[n - 1]);
+}
@@ -0,0 +1,42 @@
+#ifndef _INFLOW_HYDROGRAPH_H_
+#define _INFLOW_HYDROGRAPH_H_
+
+#include <string>
+#include <vector>
+#include "global_defs.h"
+
+/// \brief Time series of the scale factor applied to the boundary inflow
+///
+/// Read from a small CSV file with the columns day, hour and scale, for example
+/// \code
+/// day,hour,scale
+/// 144,0,0.2
+/// 170,12,1.5
+/// 282,0,0.1
+/// \endcode
+/// Rows must be in increasing time order. The scale is interpolated linearly in
+/// time and held constant before the first and after the last row. The header row
+/// and lines starting with # are skipped.
+class InflowHydrograph {
+    private:
+        std::vector<real_type> times;  ///< Time of each row in decimal days (day + hour / 24)
+        std::vector<real_type> scales;  ///< Scale factor of each row
+
+    public:
+        /// \brief Create an empty InflowHydrograph, which has a scale of 1 at all times
+        InflowHydrograph();
+
+        /// \brief Load the hydrograph from a CSV file
+        /// \param filename Name of the CSV file
+        void load(const std::string& filename);
+
+        /// \brief Number of rows in the hydrograph
+        int size() const { return times.size(); }
+
+        /// \brief Scale factor at a given time
+        /// \param day Day of the year
+        /// \param hour Hour of the day
+        real_type scale(int day, int hour) const;
+};
+
+#endif
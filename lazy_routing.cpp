@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "raster.h"
+#include "utility.h"
+#include "lazy_routing.h"
+
+
+LazyRouting::LazyRouting() : size_x(0), size_y(0), tile_size(32), tiles_x(0), tiles_y(0), force_interval(24), tolerance(0),
+        steps_since_routing(0), routings(0), skipped(0), forced(0), validations(0), max_error(0),
+        total_mean_error(0) {}
+
+void LazyRouting::initialise(Raster& topo, Parameters& params) {
+    size_x = topo.get_size_x();
+    size_y = topo.get_size_y();
+    tile_size = params.get_lazy_tile_size();
+    force_interval = params.get_lazy_force_interval();
+    tolerance = params.get_lazy_tolerance();
+    tiles_x = (size_x + tile_size - 1) / tile_size;
+    tiles_y = (size_y + tile_size - 1) / tile_size;
+    min_gap.assign(tiles_x * tiles_y, 0);
+    min_change.assign(tiles_x * tiles_y, 0);
+    max_change.assign(tiles_x * tiles_y, 0);
+    steps_since_routing = 0;
+    routings = 0;
+    skipped = 0;
+    forced = 0;
+    validations = 0;
+    max_error = 0;
+    total_mean_error = 0;
+}
+
+/// Routing is needed the first time, after force_interval skipped steps, or when the
+/// range of the changes around any tile reaches its smallest neighbour difference.
+/// The changes of a tile are combined with the tiles around it, since the difference
+/// between two neighbours on either side of a tile edge is stored in only one of the
+/// tiles.
+bool LazyRouting::needs_routing(Raster& topo) {
+    if (topo.get_size_x() != size_x || topo.get_size_y() != size_y) {
+        Util::Error("Must initialise LazyRouting", 1);
+    }
+
+    bool route = (routings == 0);
+    if (!route && steps_since_routing + 1 >= force_interval) {
+        route = true;
+        forced++;
+    }
+
+    if (!route) {
+        // largest drop and rise in each tile
+        #pragma omp parallel for
+        for (int t = 0; t < tiles_x * tiles_y; t++) {
+            int ti = t / tiles_y;
+            int tj = t % tiles_y;
+            real_type lowest = std::numeric_limits<real_type>::max();
+            real_type highest = -std::numeric_limits<real_type>::max();
+            for (int i = ti * tile_size; i < std::min((ti + 1) * tile_size, size_x); i++) {
+                for (int j = tj * tile_size; j < std::min((tj + 1) * tile_size, size_y); j++) {
+                    real_type change = topo(i, j) - routed_topo(i, j);
+                    lowest = std::min(lowest, change);
+                    highest = std::max(highest, change);
+                }
+            }
+            min_change[t] = lowest;
+            max_change[t] = highest;
+        }
+
+        // compare with the gaps, including the changes of the surrounding tiles
+        for (int ti = 0; ti < tiles_x && !route; ti++) {
+            for (int tj = 0; tj < tiles_y && !route; tj++) {
+                real_type lowest = std::numeric_limits<real_type>::max();
+                real_type highest = -std::numeric_limits<real_type>::max();
+                for (int ni = std::max(ti - 1, 0); ni <= std::min(ti + 1, tiles_x - 1); ni++) {
+                    for (int nj = std::max(tj - 1, 0); nj <= std::min(tj + 1, tiles_y - 1); nj++) {
+                        lowest = std::min(lowest, min_change[ni * tiles_y + nj]);
+                        highest = std::max(highest, max_change[ni * tiles_y + nj]);
+                    }
+                }
+                route = (highest - lowest >= min_gap[ti * tiles_y + tj]);
+            }
+        }
+    }
+
+    if (!route) {
+        skipped++;
+        steps_since_routing++;
+    }
+    return route;
+}
+
+void LazyRouting::routed(Raster& topo) {
+    routed_topo = topo;
+    steps_since_routing = 0;
+    routings++;
+
+    // neighbour pairs are stored with the cell with the lower index: (i + 1, j), (i, j + 1), (i + 1, j +/- 1)
+    const int di[4] = {1, 0, 1, 1};
+    const int dj[4] = {0, 1, 1, -1};
+    #pragma omp parallel for
+    for (int t = 0; t < tiles_x * tiles_y; t++) {
+        int ti = t / tiles_y;
+        int tj = t % tiles_y;
+        real_type gap = std::numeric_limits<real_type>::max();
+        for (int i = ti * tile_size; i < std::min((ti + 1) * tile_size, size_x); i++) {
+            for (int j = tj * tile_size; j < std::min((tj + 1) * tile_size, size_y); j++) {
+                for (int n = 0; n < 4; n++) {
+                    int ni = i + di[n];
+                    int nj = j + dj[n];
+                    if (ni < size_x && nj >= 0 && nj < size_y) {
+                        real_type dz = std::abs(topo(i, j) - topo(ni, nj));
+                        if (dz > tolerance) {
+                            gap = std::min(gap, dz);
+                        }
+                    }
+                }
+            }
+        }
+        min_gap[t] = gap;
+    }
+}
+
+/// The error of a cell is relative to its fresh flow, which is at least the pixel area.
+void LazyRouting::record_error(Raster& cached, Raster& fresh) {
+    real_type error = 0;
+    real_type sum = 0;
+    #pragma omp parallel for reduction(max: error) reduction(+: sum)
+    for (int n = 0; n < size_x * size_y; n++) {
+        real_type cell_error = std::abs(cached[n] - fresh[n]) / fresh[n];
+        error = std::max(error, cell_error);
+        sum += cell_error;
+    }
+    max_error = std::max(max_error, error);
+    total_mean_error += sum / (size_x * size_y);
+    validations++;
+}
@@ -0,0 +1,88 @@
+#ifndef _LAZY_ROUTING_H_
+#define _LAZY_ROUTING_H_
+
+#include <vector>
+#include "raster.h"
+#include "parameters.h"
+#include "global_defs.h"
+
+/// \brief Decide when the flow needs routing again after the topography changes
+///
+/// The grid is split into square tiles. When the flow is routed, the elevations
+/// are stored and each tile records the smallest elevation difference between
+/// neighbouring cells in it. Before the next routing the range of the elevation
+/// changes since then (largest rise minus largest drop) is found for each tile.
+/// As long as that range, taken over the tile and the tiles around it, is below
+/// the tile's smallest difference, no pair of neighbours can have swapped order
+/// and no MFD weight can have changed sign, so the cached flow is kept. A uniform
+/// change such as uplift never triggers routing. Routing is forced after a set
+/// number of skipped steps, since the weights themselves still drift.
+/// Only the sort and the routing are skipped; the flood runs every step, as channel
+/// erosion works on the filled surface.
+///
+/// Differences below a tolerance are left out of the smallest difference. They
+/// are cells on flats filled by the flood, where the flood rather than the
+/// original order decides where the flow goes.
+class LazyRouting {
+    private:
+        int size_x;  ///< Number of cells in the x dimension
+        int size_y;  ///< Number of cells in the y dimension
+        int tile_size;  ///< Width of the square tiles in cells
+        int tiles_x;  ///< Number of tiles in the x dimension
+        int tiles_y;  ///< Number of tiles in the y dimension
+        int force_interval;  ///< Route at least once in this many steps
+        real_type tolerance;  ///< Neighbour differences at or below this are not used for the smallest difference
+        Raster routed_topo;  ///< Elevations when the flow was last routed
+        std::vector<real_type> min_gap;  ///< Smallest neighbour elevation difference in each tile at the last routing
+        std::vector<real_type> min_change;  ///< Largest drop in elevation in each tile since the last routing
+        std::vector<real_type> max_change;  ///< Largest rise in elevation in each tile since the last routing
+        int steps_since_routing;  ///< Number of steps skipped since the last routing
+        long routings;  ///< Number of times the flow was routed
+        long skipped;  ///< Number of times routing was skipped
+        long forced;  ///< Number of routings forced by force_interval
+        long validations;  ///< Number of skipped steps compared against a fresh routing
+        real_type max_error;  ///< Largest relative flow error found by record_error()
+        real_type total_mean_error;  ///< Sum over the validated steps of the mean relative flow error
+
+    public:
+        /// \brief Create a LazyRouting object
+        LazyRouting();
+
+        /// \brief Initialise the LazyRouting object
+        /// \param topo The Raster of elevations
+        /// \param params Parameters object
+        void initialise(Raster& topo, Parameters& params);
+
+        /// \brief Check whether the flow has to be routed again, counting the step as skipped if not
+        /// \param topo The Raster of elevations, before pit filling
+        bool needs_routing(Raster& topo);
+
+        /// \brief Record the elevations the flow is being routed with
+        /// \param topo The Raster of elevations, before pit filling
+        void routed(Raster& topo);
+
+        /// \brief Compare the cached flow of a skipped step with a fresh routing
+        /// \param cached The flow Raster kept from the last routing
+        /// \param fresh The flow Raster routed with the current elevations
+        void record_error(Raster& cached, Raster& fresh);
+
+        /// \brief Number of times the flow was routed
+        long get_routings() const { return routings; }
+
+        /// \brief Number of times routing was skipped
+        long get_skipped() const { return skipped; }
+
+        /// \brief Number of routings forced by the force interval
+        long get_forced() const { return forced; }
+
+        /// \brief Number of skipped steps checked by record_error()
+        long get_validations() const { return validations; }
+
+        /// \brief Largest relative flow error of a skipped step found by record_error()
+        real_type get_max_error() const { return max_error; }
+
+        /// \brief Mean relative flow error of the skipped steps checked by record_error()
+        real_type get_mean_error() const { return validations > 0 ? total_mean_error / validations : 0; }
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "raster.h"
+#include "global_defs.h"
+#include "utility.h"
+#include "multigrid_diffusion.h"
+
+
+MultigridDiffusion::MultigridDiffusion() : pre_smooth(2), post_smooth(2), coarse_sweeps(50), residual(0), change(0),
+        bytes_moved(0) {}
+
+void MultigridDiffusion::initialise(int size_x, int size_y) {
+    levels.clear();
+    int nx = size_x;
+    int ny = size_y;
+    while (true) {
+        Level level;
+        level.nx = nx;
+        level.ny = ny;
+        level.scale = 0;
+        level.u.assign(nx * ny, 0);
+        level.f.assign(nx * ny, 0);
+        level.r.assign(nx * ny, 0);
+        level.d.assign(nx * ny, 0);
+        level.fixed.assign(nx * ny, 0);
+        levels.push_back(level);
+        if (std::min(nx, ny) <= 3) {
+            break;
+        }
+        nx = (nx + 1) / 2;
+        ny = (ny + 1) / 2;
+    }
+}
+
+/// The two colours are the cells with i + j even and odd. Cells of one colour only
+/// depend on cells of the other, so each colour is updated in parallel.
+void MultigridDiffusion::smooth(Level& level, int sweeps) {
+    int nx = level.nx;
+    int ny = level.ny;
+    for (int sweep = 0; sweep < sweeps; sweep++) {
+        for (int colour = 0; colour < 2; colour++) {
+            #pragma omp parallel for
+            for (int i = 0; i < nx; i++) {
+                for (int j = (i + colour) % 2; j < ny; j += 2) {
+                    int c = i * ny + j;
+                    if (level.fixed[c]) {
+                        level.u[c] = level.f[c];
+                        continue;
+                    }
+                    const int ni[4] = {i - 1, i + 1, i, i};
+                    const int nj[4] = {j, j, j - 1, j + 1};
+                    real_type diag = 1;
+                    real_type sum = level.f[c];
+                    for (int m = 0; m < 4; m++) {
+                        if (ni[m] < 0 || ni[m] >= nx || nj[m] < 0 || nj[m] >= ny) {
+                            continue;
+                        }
+                        int n = ni[m] * ny + nj[m];
+                        real_type w = 0.5 * (level.d[c] + level.d[n]) * level.scale;
+                        diag += w;
+                        sum += w * level.u[n];
+                    }
+                    level.u[c] = sum / diag;
+                }
+            }
+        }
+    }
+    count_bytes(sweeps * nx * ny, 4, 1);
+}
+
+real_type MultigridDiffusion::compute_residual(Level& level) {
+    int nx = level.nx;
+    int ny = level.ny;
+    real_type max_residual = 0;
+    #pragma omp parallel for reduction(max: max_residual)
+    for (int i = 0; i < nx; i++) {
+        for (int j = 0; j < ny; j++) {
+            int c = i * ny + j;
+            if (level.fixed[c]) {
+                level.r[c] = 0;
+                continue;
+            }
+            const int ni[4] = {i - 1, i + 1, i, i};
+            const int nj[4] = {j, j, j - 1, j + 1};
+            real_type au = level.u[c];
+            for (int m = 0; m < 4; m++) {
+                if (ni[m] < 0 || ni[m] >= nx || nj[m] < 0 || nj[m] >= ny) {
+                    continue;
+                }
+                int n = ni[m] * ny + nj[m];
+                au += 0.5 * (level.d[c] + level.d[n]) * level.scale * (level.u[c] - level.u[n]);
+            }
+            level.r[c] = level.f[c] - au;
+            max_residual = std::max<real_type>(max_residual, std::abs(level.r[c]));
+        }
+    }
+    count_bytes(nx * ny, 4, 1);
+    return max_residual;
+}
+
+/// Coarse cell (I, J) lies on fine cell (2I, 2J). Its residual and diffusivity are the
+/// 1-2-1 weighted means over the fine cell's 3 x 3 neighbourhood, reweighted at the
+/// edges. It is fixed if any fine cell in that neighbourhood is fixed, so the coarse
+/// grids keep the fixed edges and channels of the fine grid, however thin, and the
+/// correction is only made where the fine grid is free to move.
+void MultigridDiffusion::restrict_residual(int l) {
+    Level& fine = levels[l];
+    Level& coarse = levels[l + 1];
+    coarse.scale = fine.scale / 4;
+    #pragma omp parallel for
+    for (int ci = 0; ci < coarse.nx; ci++) {
+        for (int cj = 0; cj < coarse.ny; cj++) {
+            int i = 2 * ci;
+            int j = 2 * cj;
+            real_type weights = 0;
+            real_type r = 0;
+            real_type d = 0;
+            char is_fixed = 0;
+            for (int di = -1; di <= 1; di++) {
+                for (int dj = -1; dj <= 1; dj++) {
+                    int fi = i + di;
+                    int fj = j + dj;
+                    if (fi < 0 || fi >= fine.nx || fj < 0 || fj >= fine.ny) {
+                        continue;
+                    }
+                    real_type w = (2 - std::abs(di)) * (2 - std::abs(dj));
+                    weights += w;
+                    r += w * fine.r[fi * fine.ny + fj];
+                    d += w * fine.d[fi * fine.ny + fj];
+                    is_fixed |= fine.fixed[fi * fine.ny + fj];
+                }
+            }
+            int c = ci * coarse.ny + cj;
+            coarse.fixed[c] = is_fixed;
+            coarse.f[c] = coarse.fixed[c] ? 0 : r / weights;
+            coarse.d[c] = d / weights;
+            coarse.u[c] = 0;
+        }
+    }
+    count_bytes(fine.nx * fine.ny, 2, 1);
+    count_bytes(coarse.nx * coarse.ny, 3, 1);
+}
+
+void MultigridDiffusion::prolong_correction(int l) {
+    Level& fine = levels[l];
+    Level& coarse = levels[l + 1];
+    #pragma omp parallel for
+    for (int i = 0; i < fine.nx; i++) {
+        int i0 = i / 2;
+        int i1 = std::min(i0 + i % 2, coarse.nx - 1);
+        for (int j = 0; j < fine.ny; j++) {
+            int c = i * fine.ny + j;
+            if (fine.fixed[c]) {
+                continue;
+            }
+            int j0 = j / 2;
+            int j1 = std::min(j0 + j % 2, coarse.ny - 1);
+            fine.u[c] += 0.25 * (coarse.u[i0 * coarse.ny + j0] + coarse.u[i1 * coarse.ny + j0] +
+                    coarse.u[i0 * coarse.ny + j1] + coarse.u[i1 * coarse.ny + j1]);
+        }
+    }
+    count_bytes(fine.nx * fine.ny, 2, 1);
+    count_bytes(coarse.nx * coarse.ny, 1, 0);
+}
+
+void MultigridDiffusion::v_cycle(int l) {
+    Level& level = levels[l];
+    if (l == (int) levels.size() - 1) {
+        smooth(level, coarse_sweeps);
+        return;
+    }
+    smooth(level, pre_smooth);
+    compute_residual(level);
+    restrict_residual(l);
+    v_cycle(l + 1);
+    prolong_correction(l);
+    smooth(level, post_smooth);
+}
+
+void MultigridDiffusion::load(Raster& topo, const Raster& old_topo, const Raster& diffusivity,
+        const std::vector<char>& fixed, real_type timestep) {
+    if (levels.empty() || levels[0].nx != topo.get_size_x() || levels[0].ny != topo.get_size_y()) {
+        Util::Error("Must initialise MultigridDiffusion object", 1);
+    }
+    Level& level = levels[0];
+    level.scale = timestep / (topo.get_deltax() * topo.get_deltax());
+    #pragma omp parallel for
+    for (int c = 0; c < level.nx * level.ny; c++) {
+        level.u[c] = fixed[c] ? old_topo[c] : topo[c];
+        level.f[c] = old_topo[c];
+        level.d[c] = diffusivity[c];
+        level.fixed[c] = fixed[c];
+    }
+    count_bytes(level.nx * level.ny, 6, 2);
+}
+
+/// The solution and topo swap storage rather than copying, and the next load()
+/// overwrites what was topo.
+void MultigridDiffusion::store(Raster& topo) {
+    Level& level = levels[0];
+    change = 0;
+    #pragma omp parallel for reduction(max: change)
+    for (int c = 0; c < level.nx * level.ny; c++) {
+        change = std::max<real_type>(change, std::abs(level.u[c] - topo[c]));
+    }
+    topo.swap_data(level.u);
+    count_bytes(level.nx * level.ny, 2, 0);
+}
+
+int MultigridDiffusion::solve(Raster& topo, const Raster& diffusivity, const std::vector<char>& fixed, real_type timestep,
+        real_type tolerance, int max_cycles) {
+    return solve(topo, topo, diffusivity, fixed, timestep, tolerance, max_cycles);
+}
+
+int MultigridDiffusion::solve(Raster& topo, const Raster& old_topo, const Raster& diffusivity,
+        const std::vector<char>& fixed, real_type timestep, real_type tolerance, int max_cycles) {
+    bytes_moved = 0;
+    load(topo, old_topo, diffusivity, fixed, timestep);
+    int cycles = 0;
+    residual = compute_residual(levels[0]);
+    while (cycles < max_cycles && residual >= tolerance) {
+        v_cycle(0);
+        residual = compute_residual(levels[0]);
+        cycles++;
+    }
+    store(topo);
+    return cycles;
+}
+
+int MultigridDiffusion::solve_smoother_only(Raster& topo, const Raster& diffusivity, const std::vector<char>& fixed,
+        real_type timestep, real_type tolerance, int max_sweeps) {
+    bytes_moved = 0;
+    load(topo, topo, diffusivity, fixed, timestep);
+    int sweeps = 0;
+    residual = compute_residual(levels[0]);
+    while (sweeps < max_sweeps && residual >= tolerance) {
+        smooth(levels[0], 1);
+        residual = compute_residual(levels[0]);
+        sweeps++;
+    }
+    store(topo);
+    return sweeps;
+}
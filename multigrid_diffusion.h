@@ -0,0 +1,119 @@
+#ifndef _MULTIGRID_DIFFUSION_H_
+#define _MULTIGRID_DIFFUSION_H_
+
+#include <vector>
+#include "raster.h"
+#include "global_defs.h"
+
+/// \brief Geometric multigrid solver for one implicit diffusion time step
+///
+/// Solves the backward Euler step of dh/dt = div(D grad h) with a diffusivity D
+/// given at every cell,
+///
+///     h_c + dt / dx^2 sum_n D_cn (h_c - h_n) = h_old_c
+///
+/// over the four neighbours n of each cell, where D_cn is the mean of the two
+/// cells' diffusivities. Fixed cells keep their old elevation. The step is stable
+/// for any timestep. Each V-cycle smooths with red-black Gauss-Seidel (each colour
+/// an OpenMP parallel loop), restricts the residual by full weighting to a grid with
+/// half the resolution, solves for the correction there in the same way, and
+/// interpolates it back bilinearly, until the coarsest grid is 3 cells across or less.
+class MultigridDiffusion {
+    private:
+        /// \brief One grid of the hierarchy, level 0 is the model grid
+        struct Level {
+            int nx;  ///< Number of cells in the x dimension
+            int ny;  ///< Number of cells in the y dimension
+            real_type scale;  ///< dt / spacing^2 on this grid
+            std::vector<real_type> u;  ///< Solution (elevation on level 0, correction on coarser levels)
+            std::vector<real_type> f;  ///< Right hand side
+            std::vector<real_type> r;  ///< Residual
+            std::vector<real_type> d;  ///< Diffusivity
+            std::vector<char> fixed;  ///< Cells whose value is not solved for
+        };
+
+        std::vector<Level> levels;
+        int pre_smooth;  ///< Gauss-Seidel sweeps before restricting
+        int post_smooth;  ///< Gauss-Seidel sweeps after interpolating the correction
+        int coarse_sweeps;  ///< Gauss-Seidel sweeps on the coarsest grid
+        real_type residual;  ///< Largest residual after the last solve
+        real_type change;  ///< Largest change in elevation made by the last solve
+        double bytes_moved;  ///< Bytes of grids read and written by the last solve
+
+        /// \brief Count a pass that reads or writes reals real_type arrays and flags char arrays of cells cells
+        void count_bytes(int cells, int reals, int flags) {
+            bytes_moved += (double) cells * (reals * sizeof(real_type) + flags * sizeof(char));
+        }
+
+        /// \brief Set up the model grid level from the starting guess and the old elevations
+        void load(Raster& topo, const Raster& old_topo, const Raster& diffusivity, const std::vector<char>& fixed,
+                real_type timestep);
+
+        /// \brief Swap the solution on the model grid level into topo, measuring the change
+        void store(Raster& topo);
+
+        /// \brief Red-black Gauss-Seidel sweeps on a level
+        void smooth(Level& level, int sweeps);
+
+        /// \brief Compute the residual of a level
+        /// \return The largest absolute residual
+        real_type compute_residual(Level& level);
+
+        /// \brief Full weighting of the residual (and diffusivity) of a level onto the next coarser level
+        void restrict_residual(int l);
+
+        /// \brief Add the bilinear interpolation of the correction on level l + 1 to level l
+        void prolong_correction(int l);
+
+        /// \brief One V-cycle starting at level l
+        void v_cycle(int l);
+
+    public:
+        /// \brief Create a MultigridDiffusion object
+        MultigridDiffusion();
+
+        /// \brief Build the grid hierarchy
+        /// \param size_x Number of cells in the x dimension
+        /// \param size_y Number of cells in the y dimension
+        void initialise(int size_x, int size_y);
+
+        /// \brief Diffuse the elevations for one time step
+        /// \param topo The Raster of elevations, updated in place
+        /// \param diffusivity The Raster of diffusivity (m^2 / yr, scaled as D)
+        /// \param fixed Flags the cells (index i * size_y + j) that keep their elevation
+        /// \param timestep Time step in years
+        /// \param tolerance Stop once the largest residual (m) is below this
+        /// \param max_cycles Largest number of V-cycles
+        /// \return The number of V-cycles done
+        int solve(Raster& topo, const Raster& diffusivity, const std::vector<char>& fixed, real_type timestep,
+                real_type tolerance, int max_cycles);
+
+        /// \brief Diffuse old_topo for one time step, starting the V-cycles from topo
+        ///
+        /// As solve(), for an iteration that already has a better guess than the old
+        /// elevations. Fixed cells take their elevation from old_topo.
+        /// \param topo The starting guess, replaced by the new elevations
+        /// \param old_topo The Raster of elevations at the start of the time step
+        /// \return The number of V-cycles done
+        int solve(Raster& topo, const Raster& old_topo, const Raster& diffusivity, const std::vector<char>& fixed,
+                real_type timestep, real_type tolerance, int max_cycles);
+
+        /// \brief Run red-black Gauss-Seidel on the model grid only, for comparison with the V-cycle
+        /// \return The number of sweeps done
+        int solve_smoother_only(Raster& topo, const Raster& diffusivity, const std::vector<char>& fixed,
+                real_type timestep, real_type tolerance, int max_sweeps);
+
+        /// \brief Largest residual (m) after the last solve
+        real_type get_residual() const { return residual; }
+
+        /// \brief Largest change (m) from the starting elevations made by the last solve
+        real_type get_change() const { return change; }
+
+        /// \brief Bytes of grids read and written by the last solve, counting each array once per pass
+        double get_bytes_moved() const { return bytes_moved; }
+
+        /// \brief Number of grids in the hierarchy
+        int get_num_levels() const { return levels.size(); }
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include "raster.h"
+#include "utility.h"
+#include "parallel_flow_accumulator.h"
+
+
+ParallelFlowAccumulator::ParallelFlowAccumulator() : ncells(0) {}
+
+/// An edge c -> r is a dependency if r comes after c in the graph order. Edges to
+/// cells earlier in the order only carry boundary inflow (their weight is zero) and
+/// become late inflow. Edges from a cell to itself are handled when the cell is
+/// processed.
+///
+/// The inflow is placed on its cells from the positions the router found while
+/// sorting, and only those cells are cleared again on the next call, so no cell is
+/// looked up in the inflow list.
+void ParallelFlowAccumulator::setup(const ReceiverGraph& graph, const BoundaryInflow& inflow,
+        const std::vector<int>& inflow_positions, const std::vector<int>& inflow_entries) {
+    int nedges = graph.receivers.size();
+    if ((int) graph.order.size() != ncells) {
+        ncells = graph.order.size();
+        cell_inflow.assign(ncells, 0);
+        inflow_cells.clear();
+    }
+    for (int c : inflow_cells) {
+        cell_inflow[c] = 0;
+    }
+    inflow_cells.clear();
+    for (size_t k = 0; k < inflow_positions.size(); k++) {
+        int c = graph.order[inflow_positions[k]];
+        cell_inflow[c] = inflow.get_inflow(inflow_entries[k]);
+        inflow_cells.push_back(c);
+    }
+
+    position.resize(ncells);
+    #pragma omp parallel for
+    for (int t = 0; t < ncells; t++) {
+        position[graph.order[t]] = t;
+    }
+
+    // count donors and late inflow of each cell
+    donor_offsets.assign(ncells + 1, 0);
+    late_offsets.assign(ncells + 1, 0);
+    for (int c = 0; c < ncells; c++) {
+        for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+            int r = graph.receivers[e];
+            if (position[r] > position[c]) {
+                donor_offsets[r + 1]++;
+            }
+            else if (r != c) {
+                late_offsets[r + 1]++;
+            }
+        }
+    }
+    for (int c = 0; c < ncells; c++) {
+        donor_offsets[c + 1] += donor_offsets[c];
+        late_offsets[c + 1] += late_offsets[c];
+    }
+
+    // fill both lists visiting donors in graph order, which is the serial summation order
+    donor_edges.resize(donor_offsets[ncells]);
+    late_inflow.resize(late_offsets[ncells]);
+    std::vector<int> donor_fill(donor_offsets.begin(), donor_offsets.end() - 1);
+    std::vector<int> late_fill(late_offsets.begin(), late_offsets.end() - 1);
+    for (int c : graph.order) {
+        for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+            int r = graph.receivers[e];
+            if (position[r] > position[c]) {
+                donor_edges[donor_fill[r]++] = e;
+            }
+            else if (r != c) {
+                late_inflow[late_fill[r]++] = cell_inflow[c];
+            }
+        }
+    }
+
+    if ((int) donors_left.size() != ncells) {
+        donors_left = std::vector<std::atomic<int> >(ncells);
+    }
+    #pragma omp parallel for
+    for (int c = 0; c < ncells; c++) {
+        donors_left[c].store(donor_offsets[c + 1] - donor_offsets[c], std::memory_order_relaxed);
+    }
+    seeds.clear();
+    for (int c : graph.order) {
+        if (donor_offsets[c + 1] == donor_offsets[c]) {
+            seeds.push_back(c);
+        }
+    }
+    edge_flow.resize(nedges);
+}
+
+void ParallelFlowAccumulator::process(int c, const ReceiverGraph& graph, real_type area, Raster& flow,
+        TracerSet* tracers, std::vector<int>& ready) {
+    // gather from the donors in the fixed order
+    real_type value = area;
+    for (int d = donor_offsets[c]; d < donor_offsets[c + 1]; d++) {
+        value += edge_flow[donor_edges[d]];
+    }
+
+    // pass flow on, reading the cell's own flow again after each edge back to itself
+    real_type fa = cell_inflow[c];
+    for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+        if (graph.receivers[e] == c) {
+            value += value * graph.weights[e] + fa;
+        }
+        else {
+            edge_flow[e] = value * graph.weights[e] + fa;
+        }
+    }
+    flow[c] = value;
+
+    // tracers, which start from the amount generated in the cell and get no boundary inflow
+    if (tracers != nullptr) {
+        size_t nedges = graph.receivers.size();
+        for (int k = 0; k < tracers->get_num_tracers(); k++) {
+            real_type* t = tracers->tracer(k);
+            real_type* edge_t = &edge_tracers[k * nedges];
+            real_type amount = t[c];
+            for (int d = donor_offsets[c]; d < donor_offsets[c + 1]; d++) {
+                amount += edge_t[donor_edges[d]];
+            }
+            for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+                if (graph.receivers[e] == c) {
+                    amount += amount * graph.weights[e];
+                }
+                else {
+                    edge_t[e] = amount * graph.weights[e];
+                }
+            }
+            t[c] = amount;
+        }
+    }
+
+    // release receivers whose last donor this was; the release and acquire order the
+    // edge values written above before the receiver's reads of them on another thread
+    for (int e = graph.offsets[c]; e < graph.offsets[c + 1]; e++) {
+        int r = graph.receivers[e];
+        if (position[r] <= position[c]) continue;
+        if (donors_left[r].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ready.push_back(r);
+        }
+    }
+}
+
+void ParallelFlowAccumulator::run(const ReceiverGraph& graph, const BoundaryInflow& inflow,
+        const std::vector<int>& inflow_positions, const std::vector<int>& inflow_entries, real_type area, Raster& flow,
+        TracerSet* tracers) {
+    setup(graph, inflow, inflow_positions, inflow_entries);
+    if (tracers != nullptr) {
+        edge_tracers.resize(tracers->get_num_tracers() * graph.receivers.size());
+    }
+
+    // a thread follows each seed it takes on to every cell that it releases
+    int nseeds = seeds.size();
+    #pragma omp parallel
+    {
+        std::vector<int> ready;
+        #pragma omp for schedule(dynamic, 64)
+        for (int s = 0; s < nseeds; s++) {
+            ready.push_back(seeds[s]);
+            while (!ready.empty()) {
+                int c = ready.back();
+                ready.pop_back();
+                process(c, graph, area, flow, tracers, ready);
+            }
+        }
+    }
+
+    // boundary inflow that arrived after the cell was visited
+    #pragma omp parallel for
+    for (int c = 0; c < ncells; c++) {
+        for (int k = late_offsets[c]; k < late_offsets[c + 1]; k++) {
+            flow[c] += late_inflow[k];
+        }
+    }
+}
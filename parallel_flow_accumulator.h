@@ -0,0 +1,68 @@
+#ifndef _PARALLEL_FLOW_ACCUMULATOR_H_
+#define _PARALLEL_FLOW_ACCUMULATOR_H_
+
+#include <vector>
+#include <atomic>
+#include "raster.h"
+#include "receiver_graph.h"
+#include "tracer_set.h"
+#include "boundary_inflow.h"
+#include "global_defs.h"
+
+/// \brief Parallel flow accumulation over a ReceiverGraph by donor counting
+///
+/// Each cell waits until all of its donors have finished. Its flow is then the
+/// pixel area plus the contributions of its donors, added in the order the
+/// serial router would add them, so the result is identical to
+/// MFDFlowRouter::run() for any number of threads. Finished cells decrement the
+/// atomic donor counts of their receivers and a receiver becomes ready when its
+/// count reaches zero. The cells with no donors are shared out to the threads by a
+/// dynamic OpenMP loop, and each thread follows the cells it releases on a private
+/// stack, so there are no locks and no thread waits for another.
+///
+/// Boundary inflow is added to every neighbour of an edge cell, including
+/// neighbours that the serial router has already visited. Those additions no
+/// longer travel downstream, so they are kept as constants added to the
+/// receiver's final flow.
+class ParallelFlowAccumulator {
+    private:
+        int ncells;  ///< Number of cells in the graph
+        std::vector<int> position;  ///< Position of each cell in the graph order
+        std::vector<real_type> cell_inflow;  ///< Boundary inflow of each cell, zero but for inflow_cells
+        std::vector<int> inflow_cells;  ///< Cells given boundary inflow by the last setup()
+        std::vector<int> donor_offsets;  ///< Start of each cell's donors in donor_edges
+        std::vector<int> donor_edges;  ///< Graph edges into each cell, in the order the serial router adds them
+        std::vector<int> late_offsets;  ///< Start of each cell's late inflow in late_inflow
+        std::vector<real_type> late_inflow;  ///< Boundary inflow arriving after the cell was visited
+        std::vector<std::atomic<int> > donors_left;  ///< Number of unfinished donors of each cell
+        std::vector<int> seeds;  ///< Cells with no donors, in graph order
+        std::vector<real_type> edge_flow;  ///< Flow passed along each graph edge
+        std::vector<real_type> edge_tracers;  ///< Tracers passed along each graph edge, one array of edges per tracer
+
+        /// \brief Build the donor lists for a graph and place the boundary inflow on its cells
+        void setup(const ReceiverGraph& graph, const BoundaryInflow& inflow, const std::vector<int>& inflow_positions,
+                const std::vector<int>& inflow_entries);
+
+        /// \brief Compute the flow of a ready cell and pass it on to its receivers
+        /// \param ready The calling thread's stack, where receivers that become ready are pushed
+        void process(int c, const ReceiverGraph& graph, real_type area, Raster& flow, TracerSet* tracers,
+                std::vector<int>& ready);
+
+    public:
+        /// \brief Create a ParallelFlowAccumulator object
+        ParallelFlowAccumulator();
+
+        /// \brief Accumulate flow along a receiver graph
+        /// \param graph Receiver graph from MFDFlowRouter
+        /// \param inflow Boundary inflow
+        /// \param inflow_positions Positions in graph.order of the cells with inflow
+        /// \param inflow_entries Entry in inflow of each of inflow_positions
+        /// \param area Flow generated in each cell (the pixel area)
+        /// \param flow Raster that will contain the accumulated flow
+        /// \param tracers Optional tracers, holding the amount generated in each cell on entry and the
+        ///                accumulated amount on exit
+        void run(const ReceiverGraph& graph, const BoundaryInflow& inflow, const std::vector<int>& inflow_positions,
+                const std::vector<int>& inflow_entries, real_type area, Raster& flow, TracerSet* tracers = nullptr);
+};
+
+#endif
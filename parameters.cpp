@@ -10,10 +10,19 @@ Parameters::Parameters() : U(0.01), K(0.001), D(1.5), melt(250), timestep(1), pr
         init_sed_track(2), init_veg(8), year(2010), day(145), hour(12), minute(0),
         end_year(2015), end_day(1), latitude(0), longitude(0), stdmed(0), declination(0),
         altitude(0), azimuth(0), topo_file("topo.asc"), fa_file("FA.asc"),
-        sed_file("SedThickness.asc"), fix_random_seed(false), save_topo(true), save_flow(false),
-        flood_algorithm(2), avalanche(true), flood(true), flow_routing(true),
+        sed_file("SedThickness.asc"), inflow_hydrograph_file(""), domain_outlet_i(-1), domain_outlet_j(-1),
+        fix_random_seed(false), save_topo(true), save_flow(false),
+        save_flow_graph(false),
+        flood_algorithm(2), flood_parallel_fill(false), flat_resolution(false), flood_incremental(false), full_flood_interval(10), avalanche(true), flood(true), flow_routing(true),
         diffusive_erosion(true), uplift(true), melt_component(true), channel_erosion(true),
-        debug_melt(false) {}
+        debug_melt(false), melt_stage(false), implicit_channel_erosion(false), avalanche_worklist(false), avalanche_track_mass(false),
+        avalanche_band_height(0), diffusion_min_change(0), diffusion_max_iterations(5),
+        diffusion_solver("adi"), saturated_D(0), diffusion_transport("linear"), critical_slope(1.25),
+        nonlinear_iterations(10), diffusion_batched(false), diffusion_line_solver("thomas"),
+        basin_parallel(false),
+        flow_router("mfd"), mfd_exponent(1.1), fast_pow(false), route_meltwater(false),
+        route_sediment(false), lazy_routing(false), lazy_tile_size(32), lazy_force_interval(24),
+        lazy_tolerance(1e-3), lazy_validate(false), parallel_accumulation(false) {}
 
 
 /// Load parameter values from a .INI file. Parameters can be omitted from the file,
@@ -36,6 +45,7 @@ Parameters::Parameters(const std::string& parameter_file) : Parameters() {
     set_printinterval(reader.GetInteger("output", "printinterval", printinterval)); // Output timestep, in hours
     set_save_topo(reader.GetBoolean("output", "save_topo", save_topo));
     set_save_flow(reader.GetBoolean("output", "save_flow", save_flow));
+    set_save_flow_graph(reader.GetBoolean("output", "save_flow_graph", save_flow_graph));
 
 //  thresh(0.577 * deltax;   // Critical height in m above neighbouring pixel, at 30 deg  (TAN(RADIANS(33deg))*deltax
 //  thresh_diag(thresh * sqrt2;
@@ -65,6 +75,11 @@ Parameters::Parameters(const std::string& parameter_file) : Parameters() {
     set_topo_file(reader.Get("input", "topo", topo_file));
     set_fa_file(reader.Get("input", "FA", fa_file));
     set_sed_file(reader.Get("input", "sed", sed_file));
+    set_inflow_hydrograph_file(reader.Get("input", "inflow_hydrograph", inflow_hydrograph_file));
+
+    // restrict the model to the catchment of an outlet
+    set_domain_outlet_i(reader.GetInteger("domain", "outlet_i", domain_outlet_i));
+    set_domain_outlet_j(reader.GetInteger("domain", "outlet_j", domain_outlet_j));
 
     // should we fix the random number seed (for testing)
     set_fix_random_seed(reader.GetBoolean("random", "fix_seed", fix_random_seed));
@@ -80,9 +95,49 @@ Parameters::Parameters(const std::string& parameter_file) : Parameters() {
 
     // flood algorithm
     set_flood_algorithm(reader.GetInteger("flood", "flood_algorithm", flood_algorithm));
+    set_flood_parallel_fill(reader.GetBoolean("flood", "parallel_fill", flood_parallel_fill));
+    set_flat_resolution(reader.GetBoolean("flood", "flat_resolution", flat_resolution));
+    set_flood_incremental(reader.GetBoolean("flood", "incremental", flood_incremental));
+    set_full_flood_interval(reader.GetInteger("flood", "full_flood_interval", full_flood_interval));
 
     // melt algorithm
     set_debug_melt(reader.GetBoolean("melt", "debug_melt", debug_melt));
+    set_melt_stage(reader.GetBoolean("melt", "melt_stage", melt_stage));
+
+    // channel erosion
+    set_implicit_channel_erosion(reader.GetBoolean("channel_erosion", "implicit", implicit_channel_erosion));
+
+    // avalanching
+    set_avalanche_worklist(reader.GetBoolean("avalanche", "worklist", avalanche_worklist));
+    set_avalanche_track_mass(reader.GetBoolean("avalanche", "track_mass", avalanche_track_mass));
+    set_avalanche_band_height(reader.GetReal("avalanche", "band_height", avalanche_band_height));
+
+    // hillslope diffusion
+    set_diffusion_min_change(reader.GetReal("diffusion", "min_change", diffusion_min_change));
+    set_diffusion_max_iterations(reader.GetInteger("diffusion", "max_iterations", diffusion_max_iterations));
+    set_diffusion_solver(reader.Get("diffusion", "solver", diffusion_solver));
+    set_saturated_D(reader.GetReal("diffusion", "saturated_D", saturated_D));
+    set_diffusion_transport(reader.Get("diffusion", "transport", diffusion_transport));
+    set_critical_slope(reader.GetReal("diffusion", "critical_slope", critical_slope));
+    set_nonlinear_iterations(reader.GetInteger("diffusion", "nonlinear_iterations", nonlinear_iterations));
+    set_diffusion_batched(reader.GetBoolean("diffusion", "batched", diffusion_batched));
+    set_diffusion_line_solver(reader.Get("diffusion", "line_solver", diffusion_line_solver));
+
+    // flow routing
+    set_flow_router(reader.Get("flow", "router", flow_router));
+    set_mfd_exponent(reader.GetReal("flow", "mfd_exponent", mfd_exponent));
+    set_fast_pow(reader.GetBoolean("flow", "fast_pow", fast_pow));
+    set_route_meltwater(reader.GetBoolean("flow", "route_meltwater", route_meltwater));
+    set_route_sediment(reader.GetBoolean("flow", "route_sediment", route_sediment));
+    set_lazy_routing(reader.GetBoolean("flow", "lazy_routing", lazy_routing));
+    set_lazy_tile_size(reader.GetInteger("flow", "lazy_tile_size", lazy_tile_size));
+    set_lazy_force_interval(reader.GetInteger("flow", "lazy_force_interval", lazy_force_interval));
+    set_lazy_tolerance(reader.GetReal("flow", "lazy_tolerance", lazy_tolerance));
+    set_lazy_validate(reader.GetBoolean("flow", "lazy_validate", lazy_validate));
+
+    // parallel execution
+    set_basin_parallel(reader.GetBoolean("parallel", "basin_parallel", basin_parallel));
+    set_parallel_accumulation(reader.GetBoolean("parallel", "parallel_accumulation", parallel_accumulation));
 }
 
 void Parameters::set_day(int day_) {
@@ -158,3 +213,169 @@ void Parameters::set_flood_algorithm(int flood_algorithm_) {
         flood_algorithm = 2;  // default to 2
     }
 }
+
+void Parameters::set_full_flood_interval(int full_flood_interval_) {
+    if (full_flood_interval_ < 1) {
+        Util::Error("Full flood interval must be greater than 0", 1);
+    }
+    else {
+        full_flood_interval = full_flood_interval_;
+    }
+}
+
+void Parameters::set_flow_router(const std::string& flow_router_) {
+    if (flow_router_ != "mfd" && flow_router_ != "d8" && flow_router_ != "dinf") {
+        Util::Error("Flow router must be one of mfd, d8 or dinf", 1);
+    }
+    else {
+        flow_router = flow_router_;
+    }
+}
+
+void Parameters::set_avalanche_worklist(bool avalanche_worklist_) {
+    if (avalanche_worklist_ && avalanche_track_mass) {
+        Util::Error("Avalanche mass tracking is not supported with the worklist", 1);
+    }
+    else {
+        avalanche_worklist = avalanche_worklist_;
+    }
+}
+
+void Parameters::set_avalanche_track_mass(bool avalanche_track_mass_) {
+    if (avalanche_track_mass_ && avalanche_worklist) {
+        Util::Error("Avalanche mass tracking is not supported with the worklist", 1);
+    }
+    else {
+        avalanche_track_mass = avalanche_track_mass_;
+    }
+}
+
+void Parameters::set_avalanche_band_height(real_type avalanche_band_height_) {
+    if (avalanche_band_height_ < 0) {
+        Util::Error("Avalanche band height must not be negative", 1);
+    }
+    else {
+        avalanche_band_height = avalanche_band_height_;
+    }
+}
+
+void Parameters::set_diffusion_min_change(real_type diffusion_min_change_) {
+    if (diffusion_min_change_ < 0) {
+        Util::Error("Diffusion min change must not be negative", 1);
+    }
+    else {
+        diffusion_min_change = diffusion_min_change_;
+    }
+}
+
+void Parameters::set_diffusion_max_iterations(int diffusion_max_iterations_) {
+    if (diffusion_max_iterations_ < 1) {
+        Util::Error("Diffusion max iterations must be greater than 0", 1);
+    }
+    else {
+        diffusion_max_iterations = diffusion_max_iterations_;
+    }
+}
+
+void Parameters::set_diffusion_solver(const std::string& diffusion_solver_) {
+    if (diffusion_solver_ != "adi" && diffusion_solver_ != "multigrid") {
+        Util::Error("Diffusion solver must be one of adi or multigrid", 1);
+    }
+    else {
+        diffusion_solver = diffusion_solver_;
+    }
+}
+
+void Parameters::set_saturated_D(real_type saturated_D_) {
+    if (saturated_D_ < 0) {
+        Util::Error("Saturated diffusion rate must not be negative", 1);
+    }
+    else {
+        saturated_D = saturated_D_;
+    }
+}
+
+void Parameters::set_diffusion_transport(const std::string& diffusion_transport_) {
+    if (diffusion_transport_ != "linear" && diffusion_transport_ != "nonlinear") {
+        Util::Error("Diffusion transport must be one of linear or nonlinear", 1);
+    }
+    else {
+        diffusion_transport = diffusion_transport_;
+    }
+}
+
+void Parameters::set_critical_slope(real_type critical_slope_) {
+    if (critical_slope_ <= 0) {
+        Util::Error("Critical slope must be greater than 0", 1);
+    }
+    else {
+        critical_slope = critical_slope_;
+    }
+}
+
+void Parameters::set_nonlinear_iterations(int nonlinear_iterations_) {
+    if (nonlinear_iterations_ < 1) {
+        Util::Error("Nonlinear iterations must be greater than 0", 1);
+    }
+    else {
+        nonlinear_iterations = nonlinear_iterations_;
+    }
+}
+
+void Parameters::set_diffusion_line_solver(const std::string& diffusion_line_solver_) {
+    if (diffusion_line_solver_ != "thomas" && diffusion_line_solver_ != "pcr" && diffusion_line_solver_ != "auto") {
+        Util::Error("Diffusion line solver must be one of thomas, pcr or auto", 1);
+    }
+    else {
+        diffusion_line_solver = diffusion_line_solver_;
+    }
+}
+
+void Parameters::set_mfd_exponent(real_type mfd_exponent_) {
+    if (mfd_exponent_ <= 0) {
+        Util::Error("MFD exponent must be greater than 0", 1);
+    }
+    else {
+        mfd_exponent = mfd_exponent_;
+    }
+}
+
+void Parameters::set_lazy_tile_size(int lazy_tile_size_) {
+    if (lazy_tile_size_ < 1) {
+        Util::Error("Lazy routing tile size must be greater than 0", 1);
+    }
+    else {
+        lazy_tile_size = lazy_tile_size_;
+    }
+}
+
+void Parameters::set_lazy_force_interval(int lazy_force_interval_) {
+    if (lazy_force_interval_ < 1) {
+        Util::Error("Lazy routing force interval must be greater than 0", 1);
+    }
+    else {
+        lazy_force_interval = lazy_force_interval_;
+    }
+}
+
+void Parameters::set_lazy_tolerance(real_type lazy_tolerance_) {
+    if (lazy_tolerance_ < 0) {
+        Util::Error("Lazy routing tolerance must not be negative", 1);
+    }
+    else {
+        lazy_tolerance = lazy_tolerance_;
+    }
+}
+
+void Parameters::set_parallel_accumulation(bool parallel_accumulation_) {
+#ifdef PARALLEL_ACCUMULATION
+    parallel_accumulation = parallel_accumulation_;
+#else
+    if (parallel_accumulation_) {
+        Util::Error("Parallel flow accumulation needs a build with -DBUILD_PARALLEL_ACCUMULATION=ON", 1);
+    }
+    else {
+        parallel_accumulation = false;
+    }
+#endif
+}
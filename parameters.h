@@ -54,10 +54,18 @@ class Parameters {
         std::string topo_file;  ///< Input file name for topo (elevations) raster
         std::string fa_file;  ///< Input file name for the flow accumulation raster
         std::string sed_file;  ///< Input file name for the sediment layer
+        std::string inflow_hydrograph_file;  ///< Input CSV file scaling the boundary inflow through time (empty for constant inflow)
+        int domain_outlet_i;  ///< First index of the outlet whose catchment the model is restricted to (-1 for the whole grid)
+        int domain_outlet_j;  ///< Second index of the outlet whose catchment the model is restricted to (-1 for the whole grid)
         bool fix_random_seed;  ///< Fix the random seed
         bool save_topo;  ///< Save the topo (elevations) raster
         bool save_flow;  ///< Save the flow accumulation raster
+        bool save_flow_graph;  ///< Save the receiver graph of the flow routing for FlowQueryIndex queries
         int flood_algorithm;  ///< Choose the algorithm for flood/pit-filling
+        bool flood_parallel_fill;  ///< Run Pelletier's fillinpitsandflats as parallel wavefronts
+        bool flat_resolution;  ///< Resolve drainage over flats with a flat mask for the flow router
+        bool flood_incremental;  ///< Only re-flood the basins containing cells that changed since the last flood
+        int full_flood_interval;  ///< With incremental flooding, run a full flood every this many floods
         bool avalanche;  ///< Enable the avalanche component
         bool flood;  ///< Enable the flood component
         bool flow_routing;  ///< Enable the flow routing component
@@ -66,6 +74,32 @@ class Parameters {
         bool melt_component;  ///< Enable the melt component
         bool channel_erosion;  ///< Enable the channel erosion component
         bool debug_melt;   ///< Write out additional Rasters for debugging the RadiationModel
+        bool melt_stage;  ///< Apply melt to all melting cells at once before avalanching
+        bool implicit_channel_erosion;  ///< Solve channel erosion implicitly along steepest descent receivers
+        bool avalanche_worklist;  ///< Relax avalanching to convergence from a worklist of active cells
+        bool avalanche_track_mass;  ///< Deposit failed material downslope and track it in Sed_Track (not with the worklist)
+        real_type avalanche_band_height;  ///< Height of the elevation bands avalanched in parallel, 0 for serial
+        real_type diffusion_min_change;  ///< Stop the diffusion iterations early once no elevation changes by this much (m) in one
+        int diffusion_max_iterations;  ///< Largest number of diffusion ADI iterations per time step
+        std::string diffusion_solver;  ///< Hillslope diffusion solver: adi or multigrid
+        real_type saturated_D;  ///< Diffusion rate of cells lowered by melt in the step with the multigrid solver or nonlinear transport, 0 to use D
+        std::string diffusion_transport;  ///< Hillslope transport law: linear or nonlinear (critical slope)
+        real_type critical_slope;  ///< Slope at which nonlinear hillslope transport becomes unbounded
+        int nonlinear_iterations;  ///< Largest number of Picard iterations per time step for nonlinear transport
+        bool diffusion_batched;  ///< Solve the hillslope diffusion lines in parallel batches with zebra ordering
+        std::string diffusion_line_solver;  ///< Batched diffusion line solver: thomas (default), pcr or auto
+        bool basin_parallel;  ///< Run flow routing and avalanching basin by basin in parallel
+        std::string flow_router;  ///< Flow partition scheme: mfd, d8 or dinf
+        real_type mfd_exponent;  ///< Exponent applied to the drop to each neighbour in MFD flow routing
+        bool fast_pow;  ///< Use a fast polynomial approximation of pow in MFD flow routing
+        bool route_meltwater;  ///< Route meltwater downstream along with the flow
+        bool route_sediment;  ///< Route channel eroded sediment downstream along with the flow
+        bool lazy_routing;  ///< Only route the flow again when the topography has changed enough
+        int lazy_tile_size;  ///< Width in cells of the tiles used to track topographic change for lazy routing
+        int lazy_force_interval;  ///< With lazy routing, route the flow at least once in this many steps
+        real_type lazy_tolerance;  ///< With lazy routing, ignore neighbour elevation differences up to this (m)
+        bool lazy_validate;  ///< With lazy routing, compare the cached flow against a fresh routing on skipped steps
+        bool parallel_accumulation;  ///< Accumulate flow with the parallel donor counting accumulator
 
     public:
         /// \brief Default Parameters object
@@ -150,6 +184,15 @@ class Parameters {
         void set_sed_file(const std::string& sed_file_) { sed_file = sed_file_; }
         std::string get_sed_file() const { return sed_file; }
 
+        void set_inflow_hydrograph_file(const std::string& inflow_hydrograph_file_) { inflow_hydrograph_file = inflow_hydrograph_file_; }
+        std::string get_inflow_hydrograph_file() const { return inflow_hydrograph_file; }
+
+        void set_domain_outlet_i(int domain_outlet_i_) { domain_outlet_i = domain_outlet_i_ < 0 ? -1 : domain_outlet_i_; }
+        int get_domain_outlet_i() const { return domain_outlet_i; }
+
+        void set_domain_outlet_j(int domain_outlet_j_) { domain_outlet_j = domain_outlet_j_ < 0 ? -1 : domain_outlet_j_; }
+        int get_domain_outlet_j() const { return domain_outlet_j; }
+
         void set_fix_random_seed(bool fix_random_seed_) { fix_random_seed = fix_random_seed_; }
         bool get_fix_random_seed() const { return fix_random_seed; }
 
@@ -159,9 +202,24 @@ class Parameters {
         void set_save_flow(bool save_flow_) { save_flow = save_flow_; }
         bool get_save_flow() const { return save_flow; }
 
+        void set_save_flow_graph(bool save_flow_graph_) { save_flow_graph = save_flow_graph_; }
+        bool get_save_flow_graph() const { return save_flow_graph; }
+
         void set_flood_algorithm(int flood_algorithm_);
         int get_flood_algorithm() const { return flood_algorithm; }
 
+        void set_flood_parallel_fill(bool flood_parallel_fill_) { flood_parallel_fill = flood_parallel_fill_; }
+        bool get_flood_parallel_fill() const { return flood_parallel_fill; }
+
+        void set_flat_resolution(bool flat_resolution_) { flat_resolution = flat_resolution_; }
+        bool get_flat_resolution() const { return flat_resolution; }
+
+        void set_flood_incremental(bool flood_incremental_) { flood_incremental = flood_incremental_; }
+        bool get_flood_incremental() const { return flood_incremental; }
+
+        void set_full_flood_interval(int full_flood_interval_);
+        int get_full_flood_interval() const { return full_flood_interval; }
+
         void set_avalanche(bool avalanche_) { avalanche = avalanche_; }
         bool get_avalanche() const { return avalanche; }
 
@@ -185,6 +243,84 @@ class Parameters {
 
         void set_debug_melt(bool debug_melt_) { debug_melt = debug_melt_; }
         bool get_debug_melt() const { return debug_melt; }
+
+        void set_melt_stage(bool melt_stage_) { melt_stage = melt_stage_; }
+        bool get_melt_stage() const { return melt_stage; }
+
+        void set_implicit_channel_erosion(bool implicit_channel_erosion_) { implicit_channel_erosion = implicit_channel_erosion_; }
+        bool get_implicit_channel_erosion() const { return implicit_channel_erosion; }
+
+        void set_avalanche_worklist(bool avalanche_worklist_);
+        bool get_avalanche_worklist() const { return avalanche_worklist; }
+
+        void set_avalanche_track_mass(bool avalanche_track_mass_);
+        bool get_avalanche_track_mass() const { return avalanche_track_mass; }
+
+        void set_avalanche_band_height(real_type avalanche_band_height_);
+        real_type get_avalanche_band_height() const { return avalanche_band_height; }
+
+        void set_diffusion_min_change(real_type diffusion_min_change_);
+        real_type get_diffusion_min_change() const { return diffusion_min_change; }
+
+        void set_diffusion_max_iterations(int diffusion_max_iterations_);
+        int get_diffusion_max_iterations() const { return diffusion_max_iterations; }
+
+        void set_diffusion_solver(const std::string& diffusion_solver_);
+        const std::string& get_diffusion_solver() const { return diffusion_solver; }
+
+        void set_saturated_D(real_type saturated_D_);
+        real_type get_saturated_D() const { return saturated_D; }
+
+        void set_diffusion_transport(const std::string& diffusion_transport_);
+        const std::string& get_diffusion_transport() const { return diffusion_transport; }
+
+        void set_critical_slope(real_type critical_slope_);
+        real_type get_critical_slope() const { return critical_slope; }
+
+        void set_nonlinear_iterations(int nonlinear_iterations_);
+        int get_nonlinear_iterations() const { return nonlinear_iterations; }
+
+        void set_diffusion_batched(bool diffusion_batched_) { diffusion_batched = diffusion_batched_; }
+        bool get_diffusion_batched() const { return diffusion_batched; }
+
+        void set_diffusion_line_solver(const std::string& diffusion_line_solver_);
+        const std::string& get_diffusion_line_solver() const { return diffusion_line_solver; }
+
+        void set_basin_parallel(bool basin_parallel_) { basin_parallel = basin_parallel_; }
+        bool get_basin_parallel() const { return basin_parallel; }
+
+        void set_flow_router(const std::string& flow_router_);
+        std::string get_flow_router() const { return flow_router; }
+
+        void set_mfd_exponent(real_type mfd_exponent_);
+        real_type get_mfd_exponent() const { return mfd_exponent; }
+
+        void set_fast_pow(bool fast_pow_) { fast_pow = fast_pow_; }
+        bool get_fast_pow() const { return fast_pow; }
+
+        void set_route_meltwater(bool route_meltwater_) { route_meltwater = route_meltwater_; }
+        bool get_route_meltwater() const { return route_meltwater; }
+
+        void set_route_sediment(bool route_sediment_) { route_sediment = route_sediment_; }
+        bool get_route_sediment() const { return route_sediment; }
+
+        void set_lazy_routing(bool lazy_routing_) { lazy_routing = lazy_routing_; }
+        bool get_lazy_routing() const { return lazy_routing; }
+
+        void set_lazy_tile_size(int lazy_tile_size_);
+        int get_lazy_tile_size() const { return lazy_tile_size; }
+
+        void set_lazy_force_interval(int lazy_force_interval_);
+        int get_lazy_force_interval() const { return lazy_force_interval; }
+
+        void set_lazy_tolerance(real_type lazy_tolerance_);
+        real_type get_lazy_tolerance() const { return lazy_tolerance; }
+
+        void set_lazy_validate(bool lazy_validate_) { lazy_validate = lazy_validate_; }
+        bool get_lazy_validate() const { return lazy_validate; }
+
+        void set_parallel_accumulation(bool parallel_accumulation_);
+        bool get_parallel_accumulation() const { return parallel_accumulation; }
 };
 
 #endif
@@ -2,6 +2,7 @@
 #define pit_fill_include
 #include "Array2D.hpp"
 #include "data_structures.h"
+#include "flood_queue.hpp"
 #include <queue>
 #include <limits>
 #include <iostream>
@@ -10,6 +11,193 @@
 
 
 
+//flood_seed_edges
+/**
+  @brief  Prepares a workspace and queues the edge cells of the DEM
+  @author Richard Barnes (rbarnes@umn.edu)
+
+	All edge cells are closed and added to the open queue. This is the
+	starting point of every full Priority-Flood.
+
+  @param[in,out]  &elevations   A grid of cell elevations
+  @param[in,out]  &ws           Queues and closed bitmap, reused between calls
+*/
+template <class elev_t>
+void flood_seed_edges(Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws)
+{
+	const int width = elevations.viewWidth();
+	const int height = elevations.viewHeight();
+	std::vector<elev_t*> &rows = ws.rows;
+
+	ws.prepare((size_t)width * height);
+	rows.resize(height);
+	for (int y = 0; y < height; y++)
+		rows[y] = elevations.rowRef(y).data();
+
+	for (int x = 0; x < width; x++)
+	{
+		ws.open.push(rows[0][x], x);
+		ws.open.push(rows[height - 1][x], (height - 1) * width + x);
+		ws.closed.set(x);
+		ws.closed.set((height - 1) * width + x);
+	}
+	for (int y = 1; y < height - 1; y++)
+	{
+		ws.open.push(rows[y][0], y * width);
+		ws.open.push(rows[y][width - 1], y * width + width - 1);
+		ws.closed.set(y * width);
+		ws.closed.set(y * width + width - 1);
+	}
+}
+
+
+
+//flood_seed_region
+/**
+  @brief  Prepares a workspace for flooding part of the DEM
+
+	Only the cells listed in **region** are opened. Every cell outside the
+	region is closed and assumed to already drain to the edge, so the cells
+	bordering the region act as the outlets of the flood, in the same way the
+	DEM edge does for a full flood. Region cells on the edge of the DEM are
+	outlets too.
+
+  @param[in,out]  &elevations   A grid of cell elevations
+  @param[in,out]  &ws           Queues and closed bitmap, reused between calls
+  @param[in]      &region       Linear indices (y * width + x) of the cells to flood
+*/
+template <class elev_t>
+void flood_seed_region(Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws, const std::vector<uint32_t> &region)
+{
+	const int width = elevations.viewWidth();
+	const int height = elevations.viewHeight();
+	const size_t ncells = (size_t)width * height;
+	std::vector<elev_t*> &rows = ws.rows;
+
+	ws.prepare(ncells);
+	rows.resize(height);
+	for (int y = 0; y < height; y++)
+		rows[y] = elevations.rowRef(y).data();
+
+	if (ws.seeded.size() != ncells)
+		ws.seeded.resize(ncells);
+	else
+		ws.seeded.clear();
+
+	ws.closed.set_all();
+	for (uint32_t ci : region)
+	{
+		int cx = ci % width;
+		int cy = ci / width;
+		if (cx == 0 || cy == 0 || cx == width - 1 || cy == height - 1)
+		{
+			ws.open.push(rows[cy][cx], ci);
+			ws.seeded.set(ci);
+		}
+		else
+			ws.closed.reset(ci);
+	}
+
+	for (uint32_t ci : region)
+	{
+		int cx = ci % width;
+		int cy = ci / width;
+		for (int n = 1; n <= 8; n++)
+		{
+			int nx = cx + dx[n];
+			int ny = cy + dy[n];
+			if (!elevations.in_grid(nx, ny)) continue;
+			uint32_t ni = ny * width + nx;
+			if (!ws.closed.test(ni) || ws.seeded.test(ni))
+				continue;
+			ws.seeded.set(ni);
+			ws.open.push(rows[ny][nx], ni);
+		}
+	}
+}
+
+
+
+//flood_reset_labels
+/**
+  @brief  Clears a watershed label grid before a full flood
+
+  @param[in]      &elevations   A grid of cell elevations
+  @param[in,out]  &ws           Workspace holding the next free label
+  @param[out]     &labels       Grid of watershed labels, set to -1 everywhere
+*/
+template <class elev_t>
+void flood_reset_labels(const Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws, Array2D<int32_t> &labels)
+{
+	if (labels.empty() || labels.viewWidth() != elevations.viewWidth() || labels.viewHeight() != elevations.viewHeight())
+		labels.resize(elevations.viewWidth(), elevations.viewHeight(), -1);
+	else
+		labels.setAll(-1);
+	labels.setNoData(-1);
+	ws.next_label = 1;
+}
+
+
+
+//original_priority_flood_process
+/**
+  @brief  Runs the queue of a seeded workspace for original_priority_flood()
+  @author Richard Barnes (rbarnes@umn.edu)
+
+	If **labels** is given then queued cells inherit the watershed label of
+	the cell that queued them and unlabelled seeds are given a new label, as
+	in priority_flood_watersheds().
+
+  @param[in,out]  &elevations   A grid of cell elevations
+  @param[in,out]  &ws           Workspace seeded by flood_seed_edges() or flood_seed_region()
+  @param[in,out]  *labels       Optional grid of watershed labels
+*/
+template <class elev_t>
+void original_priority_flood_process(Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws, Array2D<int32_t> *labels)
+{
+	const int width = elevations.viewWidth();
+	const int height = elevations.viewHeight();
+	FloodQueue<elev_t> &open = ws.open;
+	CellBitmap &closed = ws.closed;
+	std::vector<elev_t*> &rows = ws.rows;
+	unsigned long processed_cells = 0;
+	unsigned long pitc = 0;
+
+	while (!open.empty())
+	{
+		uint32_t ci = open.top().idx;
+		open.pop();
+		processed_cells++;
+		int cx = ci % width;
+		int cy = ci / width;
+		elev_t cz = rows[cy][cx];
+		bool interior = cx > 0 && cy > 0 && cx < width - 1 && cy < height - 1;
+
+		if (labels && (*labels)(cx, cy) == -1 && cz != elevations.noData())
+			(*labels)(cx, cy) = ws.next_label++;
+
+		for (int n = 1; n <= 8; n++)
+		{
+			int nx = cx + dx[n];
+			int ny = cy + dy[n];
+			if (!interior && !elevations.in_grid(nx, ny)) continue;
+			uint32_t ni = ny * width + nx;
+			if (closed.test(ni))
+				continue;
+
+			closed.set(ni);
+			if (labels)
+				(*labels)(nx, ny) = (*labels)(cx, cy);
+			elev_t &nz = rows[ny][nx];
+			if (nz < cz) ++pitc;
+			nz = std::max(nz, cz);
+			open.push(nz, ni);
+		}
+	}
+}
+
+
+
 //original_priority_flood
 /**
   @brief  Fills all pits and removes all digital dams from a DEM
@@ -22,6 +210,8 @@
 	they are raised to match its elevation; this fills depressions.
 
   @param[in,out]  &elevations   A grid of cell elevations
+  @param[in,out]  &ws           Queues and closed bitmap, reused between calls
+  @param[out]     *labels       Optional grid to hold watershed labels
 
   @pre
 	1. **elevations** contains the elevations of every cell or a value _NoData_
@@ -32,66 +222,22 @@
 	1. **elevations** contains the elevations of every cell or a value _NoData_
 	   for cells not part of the DEM.
 	2. **elevations** contains no landscape depressions or digital dams.
+	3. **labels**, if given, labels every cell with the edge cell it drains to.
 */
 template <class elev_t>
-void original_priority_flood(Array2D<elev_t> &elevations)
+void original_priority_flood(Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws, Array2D<int32_t> *labels = nullptr)
 {
-	grid_cellz_pq<elev_t> open;
-	unsigned long processed_cells = 0;
-	unsigned long pitc = 0;
-	//ProgressBar progress;
-
-	//std::cerr << "\n###Barnes Flood" << std::endl;
-	//std::cerr << "Setting up boolean flood array matrix..." << std::flush;
-	Array2D<int8_t> closed(elevations.viewWidth(), elevations.viewHeight(), false);
-	//std::cerr << "succeeded." << std::endl;
-
-	//std::cerr << "The priority queue will require approximately "
-	//	<< (elevations.viewWidth() * 2 + elevations.viewHeight() * 2)*((long)sizeof(grid_cellz<elev_t>)) / 1024 / 1024
-	//	<< "MB of RAM."
-	//	<< std::endl;
-	//std::cerr << "Adding cells to the priority queue..." << std::endl;
-	for (int x = 0; x < elevations.viewWidth(); x++)
-	{
-		open.push_cell(x, 0, elevations(x, 0));
-		open.push_cell(x, elevations.viewHeight() - 1, elevations(x, elevations.viewHeight() - 1));
-		closed(x, 0) = true;
-		closed(x, elevations.viewHeight() - 1) = true;
-	}
-	for (int y = 1; y < elevations.viewHeight() - 1; y++)
-	{
-		open.push_cell(0, y, elevations(0, y));
-		open.push_cell(elevations.viewWidth() - 1, y, elevations(elevations.viewWidth() - 1, y));
-		closed(0, y) = true;
-		closed(elevations.viewWidth() - 1, y) = true;
-	}
-	//std::cerr << "succeeded." << std::endl;
-
-	//std::cerr << "%%Performing the original Priority Flood..." << std::endl;
-	//progress.start( elevations.viewWidth()*elevations.viewHeight() );
-	while (open.size() > 0)
-	{
-		grid_cellz<elev_t> c = open.top();
-		open.pop();
-		processed_cells++;
-
-		for (int n = 1; n <= 8; n++)
-		{
-			int nx = c.x + dx[n];
-			int ny = c.y + dy[n];
-			if (!elevations.in_grid(nx, ny)) continue;
-			if (closed(nx, ny))
-				continue;
+	if (labels)
+		flood_reset_labels(elevations, ws, *labels);
+	flood_seed_edges(elevations, ws);
+	original_priority_flood_process(elevations, ws, labels);
+}
 
-			closed(nx, ny) = true;
-			if (elevations(nx, ny) < elevations(c.x, c.y)) ++pitc;
-			elevations(nx, ny) = std::max(elevations(nx, ny), elevations(c.x, c.y));
-			open.push_cell(nx, ny, elevations(nx, ny));
-		}
-		//progress.update(processed_cells);
-	}
-	//std::cerr<<"\t\033[96msucceeded in "<<progress.stop()<<"s.\033[39m"<<std::endl;
-	//std::cerr<<processed_cells<<" cells processed. "<<pitc<<" in pits."<<std::endl;
+template <class elev_t>
+void original_priority_flood(Array2D<elev_t> &elevations)
+{
+	FloodWorkspace<elev_t> ws;
+	original_priority_flood(elevations, ws);
 }
 
 
@@ -202,159 +348,207 @@ void improved_priority_flood(Array2D<elev_t> &elevations)
 }
 
 
-//priority_flood_epsilon
+//priority_flood_epsilon_process
 /**
-  @brief  Assigns every cell an elevation which guarantees drainage
+  @brief  Runs the queues of a seeded workspace for priority_flood_epsilon()
   @author Richard Barnes (rbarnes@umn.edu)
 
-	This version of Priority-Flood starts on the edges of the DEM and then
-	works its way inwards using a priority queue to determine the lowest cell
-	which has a path to the edge. The neighbours of this cell are added to the
-	priority queue if they are higher. If they are lower, then their elevation
-	is increased by a small amount to ensure that they have a drainage path and
-	they are added to a "pit" queue which is used to flood pits. Cells which
-	are higher than a pit being filled are added to the priority queue. In this
-	way, pits are filled without incurring the expense of the priority queue.
+	A queued cell's elevation is never altered after it has been closed, so the
+	queues only store the linear cell index and the elevation is read back from
+	the grid. Labels are handled as in original_priority_flood_process().
 
   @param[in,out]  &elevations   A grid of cell elevations
-
-  @pre
-	1. **elevations** contains the elevations of every cell or a value _NoData_
-	   for cells not part of the DEM. Note that the _NoData_ value is assumed to
-	   be a negative number less than any actual data value.
-
-  @post
-	1. **elevations** contains the elevations of every cell or a value _NoData_
-	   for cells not part of the DEM.
-	2. **elevations** has no landscape depressions, digital dams, or flats.
+  @param[in,out]  &ws           Workspace seeded by flood_seed_edges() or flood_seed_region()
+  @param[in,out]  *labels       Optional grid of watershed labels
 */
 template <class elev_t>
-void priority_flood_epsilon(Array2D<elev_t> &elevations)
+void priority_flood_epsilon_process(Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws, Array2D<int32_t> *labels)
 {
-	grid_cellz_pq<elev_t> open;
-	std::queue<grid_cellz<elev_t> > pit;
-	// ProgressBar progress;
+	const int width = elevations.viewWidth();
+	const int height = elevations.viewHeight();
+	const elev_t no_data = elevations.noData();
+	FloodQueue<elev_t> &open = ws.open;
+	FloodFifo &pit = ws.pit;
+	CellBitmap &closed = ws.closed;
+	std::vector<elev_t*> &rows = ws.rows;
 	unsigned long processed_cells = 0;
 	unsigned long pitc = 0;
-	auto PitTop = elevations.noData();
+	auto PitTop = no_data;
 	int false_pit_cells = 0;
 
-	// std::cerr << "\n###Priority-Flood+Epsilon" << std::endl;
-	// std::cerr << "Setting up boolean flood array matrix..." << std::flush;
-	Array2D<int8_t> closed(elevations.viewWidth(), elevations.viewHeight(), false);
-	// std::cerr << "succeeded." << std::endl;
-
-	// std::cerr << "The priority queue will require approximately "
-	// 	<< (elevations.viewWidth() * 2 + elevations.viewHeight() * 2)*((long)sizeof(grid_cellz<elev_t>)) / 1024 / 1024
-	// 	<< "MB of RAM."
-	// 	<< std::endl;
-	// std::cerr << "Adding cells to the priority queue..." << std::flush;
-	for (int x = 0; x < elevations.viewWidth(); x++)
-	{
-		open.push_cell(x, 0, elevations(x, 0));
-		open.push_cell(x, elevations.viewHeight() - 1, elevations(x, elevations.viewHeight() - 1));
-		closed(x, 0) = true;
-		closed(x, elevations.viewHeight() - 1) = true;
-	}
-	for (int y = 1; y < elevations.viewHeight() - 1; y++)
+	while (!open.empty() || !pit.empty())
 	{
-		open.push_cell(0, y, elevations(0, y));
-		open.push_cell(elevations.viewWidth() - 1, y, elevations(elevations.viewWidth() - 1, y));
-		closed(0, y) = true;
-		closed(elevations.viewWidth() - 1, y) = true;
-	}
-//	std::cerr << "succeeded." << std::endl;
-
-//	std::cerr << "%%Performing Priority-Flood+Epsilon..." << std::endl;
-	// progress.start(elevations.viewWidth()*elevations.viewHeight());
-	while (open.size() > 0 || pit.size()>0)
-	{
-		grid_cellz<elev_t> c;
-		if (pit.size() > 0 && open.size() > 0 && open.top().z == pit.front().z)
+		uint32_t ci;
+		if (!pit.empty() && !open.empty() &&
+			rows[open.top().idx / width][open.top().idx % width] == rows[pit.front() / width][pit.front() % width])
 		{
-			c = open.top();
+			ci = open.top().idx;
 			open.pop();
-			PitTop = elevations.noData();
+			PitTop = no_data;
 		}
-		else if (pit.size() > 0)
+		else if (!pit.empty())
 		{
-			c = pit.front();
+			ci = pit.front();
 			pit.pop();
-			if (PitTop == elevations.noData())
-				PitTop = elevations(c.x, c.y);
+			if (PitTop == no_data)
+				PitTop = rows[ci / width][ci % width];
 		}
 		else
 		{
-			c = open.top();
+			ci = open.top().idx;
 			open.pop();
-			PitTop = elevations.noData();
+			PitTop = no_data;
 		}
 		processed_cells++;
+		int cx = ci % width;
+		int cy = ci / width;
+		// smallest step representable in elev_t (nextafterf for float, nextafter for double)
+		elev_t cz_up = std::nextafter(rows[cy][cx], std::numeric_limits<elev_t>::infinity());
+		bool interior = cx > 0 && cy > 0 && cx < width - 1 && cy < height - 1;
+
+		if (labels && (*labels)(cx, cy) == -1 && rows[cy][cx] != no_data)
+			(*labels)(cx, cy) = ws.next_label++;
 
 		for (int n = 1; n <= 8; n++)
 		{
-			int nx = c.x + dx[n];
-			int ny = c.y + dy[n];
-
-			if (!elevations.in_grid(nx, ny)) continue;
+			int nx = cx + dx[n];
+			int ny = cy + dy[n];
+			if (!interior && !elevations.in_grid(nx, ny)) continue;
 
-			if (closed(nx, ny))
+			uint32_t ni = ny * width + nx;
+			if (closed.test(ni))
 				continue;
-			closed(nx, ny) = true;
+			closed.set(ni);
+			if (labels)
+				(*labels)(nx, ny) = (*labels)(cx, cy);
 
-			if (elevations(nx, ny) == elevations.noData())
-				pit.push(grid_cellz<elev_t>(nx, ny, elevations.noData()));
+			elev_t &nz = rows[ny][nx];
+			if (nz == no_data)
+				pit.push(ni);
 
-			else if (elevations(nx, ny) <= nextafterf(c.z, std::numeric_limits<float>::infinity()))
+			else if (nz <= cz_up)
 			{
-				if (PitTop != elevations.noData() && PitTop < elevations(nx, ny) && nextafterf(c.z, std::numeric_limits<float>::infinity()) >= elevations(nx, ny))
+				if (PitTop != no_data && PitTop < nz && cz_up >= nz)
 					++false_pit_cells;
 				++pitc;
-				elevations(nx, ny) = nextafterf(c.z, std::numeric_limits<float>::infinity());
-				pit.push(grid_cellz<elev_t>(nx, ny, elevations(nx, ny)));
+				nz = cz_up;
+				pit.push(ni);
 			}
 			else
-				open.push_cell(nx, ny, elevations(nx, ny));
+				open.push(nz, ni);
 		}
-	// 	progress.update(processed_cells);
 	}
-	// std::cerr << "\t\033[96msucceeded in " << progress.stop() << "s.\033[39m" << std::endl;
-	// std::cerr << processed_cells << " cells processed. " << pitc << " in pits." << std::endl;
-	// if (false_pit_cells)
-	// 	std::cerr << "\033[91mIn assigning negligible gradients to depressions, some depressions rose above the surrounding cells. This implies that a larger storage type should be used. The problem occured for " << false_pit_cells << " of " << elevations.numDataCells() << std::endl;
+}
+
+
+
+//priority_flood_epsilon
+/**
+  @brief  Assigns every cell an elevation which guarantees drainage
+  @author Richard Barnes (rbarnes@umn.edu)
+
+	This version of Priority-Flood starts on the edges of the DEM and then
+	works its way inwards using a priority queue to determine the lowest cell
+	which has a path to the edge. The neighbours of this cell are added to the
+	priority queue if they are higher. If they are lower, then their elevation
+	is increased by a small amount to ensure that they have a drainage path and
+	they are added to a "pit" queue which is used to flood pits. Cells which
+	are higher than a pit being filled are added to the priority queue. In this
+	way, pits are filled without incurring the expense of the priority queue.
+
+  @param[in,out]  &elevations   A grid of cell elevations
+  @param[in,out]  &ws           Queues and closed bitmap, reused between calls
+  @param[out]     *labels       Optional grid to hold watershed labels
+
+  @pre
+	1. **elevations** contains the elevations of every cell or a value _NoData_
+	   for cells not part of the DEM. Note that the _NoData_ value is assumed to
+	   be a negative number less than any actual data value.
+
+  @post
+	1. **elevations** contains the elevations of every cell or a value _NoData_
+	   for cells not part of the DEM.
+	2. **elevations** has no landscape depressions, digital dams, or flats.
+	3. **labels**, if given, labels every cell with the edge cell it drains to.
+*/
+template <class elev_t>
+void priority_flood_epsilon(Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws, Array2D<int32_t> *labels = nullptr)
+{
+	if (labels)
+		flood_reset_labels(elevations, ws, *labels);
+	flood_seed_edges(elevations, ws);
+	priority_flood_epsilon_process(elevations, ws, labels);
+}
+
+template <class elev_t>
+void priority_flood_epsilon(Array2D<elev_t> &elevations)
+{
+	FloodWorkspace<elev_t> ws;
+	priority_flood_epsilon(elevations, ws);
+}
+
+
+
+//priority_flood_region
+/**
+  @brief  Re-floods part of a DEM whose other cells are already drained
+
+	The cells outside **region** are left unaltered and treated as outlets
+	(see flood_seed_region()). The region is then flooded with either the
+	epsilon or the original Priority-Flood. This is exact when the changes
+	since the last full flood are confined to the region and do not open new
+	drainage paths for cells outside it; otherwise the result is still free of
+	depressions within the region but a later full flood may lower some cells
+	outside it.
+
+  @param[in,out]  &elevations   A grid of cell elevations
+  @param[in,out]  &ws           Queues and closed bitmap, reused between calls
+  @param[in]      &region       Linear indices (y * width + x) of the cells to flood
+  @param[in]      epsilon       Use priority_flood_epsilon() rules rather than original_priority_flood()
+  @param[in,out]  *labels       Optional grid of watershed labels; region cells inherit labels from their outlets
+*/
+template <class elev_t>
+void priority_flood_region(Array2D<elev_t> &elevations, FloodWorkspace<elev_t> &ws,
+	const std::vector<uint32_t> &region, bool epsilon, Array2D<int32_t> *labels = nullptr)
+{
+	flood_seed_region(elevations, ws, region);
+	if (epsilon)
+		priority_flood_epsilon_process(elevations, ws, labels);
+	else
+		original_priority_flood_process(elevations, ws, labels);
 }
 
 
 template<>
-void priority_flood_epsilon(Array2D<uint8_t> &elevations)
+inline void priority_flood_epsilon(Array2D<uint8_t> &elevations)
 {
 	std::cerr << "Priority-Flood+Epsilon is only available for floating-point data types!" << std::endl;
 	exit(-1);
 }
 
 template<>
-void priority_flood_epsilon(Array2D<uint16_t> &elevations)
+inline void priority_flood_epsilon(Array2D<uint16_t> &elevations)
 {
 	std::cerr << "Priority-Flood+Epsilon is only available for floating-point data types!" << std::endl;
 	exit(-1);
 }
 
 template<>
-void priority_flood_epsilon(Array2D<int16_t> &elevations)
+inline void priority_flood_epsilon(Array2D<int16_t> &elevations)
 {
 	std::cerr << "Priority-Flood+Epsilon is only available for floating-point data types!" << std::endl;
 	exit(-1);
 }
 
 template<>
-void priority_flood_epsilon(Array2D<uint32_t> &elevations)
+inline void priority_flood_epsilon(Array2D<uint32_t> &elevations)
 {
 	std::cerr << "Priority-Flood+Epsilon is only available for floating-point data types!" << std::endl;
 	exit(-1);
 }
 
 template<>
-void priority_flood_epsilon(Array2D<int32_t> &elevations)
+inline void priority_flood_epsilon(Array2D<int32_t> &elevations)
 {
 	std::cerr << "Priority-Flood+Epsilon is only available for floating-point data types!" << std::endl;
 	exit(-1);
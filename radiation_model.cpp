@@ -22,6 +22,7 @@ void RadiationModel::initialise(Raster& topo, Parameters& params) {
 	solar_raster = Raster(lattice_size_x, lattice_size_y, 0.0);
 	shade_raster = Raster(lattice_size_x, lattice_size_y);
     incoming_watts = Raster(lattice_size_x, lattice_size_y, 0.0);
+    melt_cells.clear();
 	I_D = Raster(lattice_size_x, lattice_size_y);
 	I_R = Raster(lattice_size_x, lattice_size_y);
 	I_P = Raster(lattice_size_x, lattice_size_y);
@@ -211,6 +212,16 @@ void RadiationModel::melt_potential(Raster& topo, Raster& Sed_Track, Raster& flo
             }
         }
     }
+
+    // compact list of the cells that melt, so melt can be applied without a full sweep
+    melt_cells.clear();
+    for (int i = 1; i < lattice_size_x - 1; i++) {
+        for (int j = 1; j < lattice_size_y - 1; j++) {
+            if (incoming_watts(i, j) != 0) {
+                melt_cells.push_back(i * lattice_size_y + j);
+            }
+        }
+    }
 }
 
 void RadiationModel::save_rasters(std::string prefix) {
@@ -7,6 +7,7 @@
 #include "solar_geometry.h"
 #include "parameters.h"
 #include "model_time.h"
+#include <vector>
 
 /// \brief RadiationModel class for carrying out calculations associated with melt
 class RadiationModel {
@@ -30,6 +31,7 @@ class RadiationModel {
         Raster SW_Ip;
         Raster NW_Ip;
         Raster Ip_D8;  ///< Map of incoming solar flux, 8 directions
+        std::vector<int> melt_cells;  ///< Interior cells with nonzero incoming watts from the last melt_potential()
 
         /// \brief Compute solar influx
         /// \param topo The elevations Raster
@@ -59,6 +61,9 @@ class RadiationModel {
 
 		Raster incoming_watts;  ///< Incoming watts Raster is computed here and applied in Avalanche
 
+        /// \brief Interior cells (index i * size_y + j) with nonzero incoming watts, in index order
+        const std::vector<int>& get_melt_cells() const { return melt_cells; }
+
         /// \brief Get the current solar altitude
         /// \returns altitude The current solar altitude
         real_type get_solar_altitude() { return r.get_altitude(); }
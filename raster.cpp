@@ -143,6 +143,14 @@ void Raster::set_data(real_type value) {
     std::fill(data.begin(), data.end(), value);
 }
 
+// exchange the data with a vector of the same length
+void Raster::swap_data(std::vector<real_type>& other) {
+    if (other.size() != data.size()) {
+        Util::Error("Cannot swap Raster data with a vector of a different length", 1);
+    }
+    data.swap(other);
+}
+
 // check if an element is set to nodata
 bool Raster::is_nodata(int i, int j) {
     return (this->operator()(i, j) == nodata);
@@ -153,6 +161,34 @@ void Raster::set_pixel_nodata(int i, int j) {
     this->operator()(i, j) = nodata;
 }
 
+// copy a window, rows are stored from the top so the lower left corner moves up by the rows below the window
+Raster Raster::crop(int i0, int j0, int nx, int ny) const {
+    if (i0 < 0 || j0 < 0 || nx < 1 || ny < 1 || i0 + nx > size_x || j0 + ny > size_y) {
+        Util::Error("Raster crop window is outside the raster", 1);
+    }
+    Raster window(nx, ny);
+    window.xllcorner = xllcorner + j0 * deltax;
+    window.yllcorner = yllcorner + (size_x - i0 - nx) * deltax;
+    window.deltax = deltax;
+    window.nodata = nodata;
+    window.save_prec = save_prec;
+    for (int i = 0; i < nx; i++) {
+        std::copy(data.begin() + (i0 + i) * size_y + j0, data.begin() + (i0 + i) * size_y + j0 + ny,
+                window.data.begin() + i * ny);
+    }
+    return window;
+}
+
+void Raster::paste(const Raster& window, int i0, int j0) {
+    if (i0 < 0 || j0 < 0 || i0 + window.size_x > size_x || j0 + window.size_y > size_y) {
+        Util::Error("Raster paste window is outside the raster", 1);
+    }
+    for (int i = 0; i < window.size_x; i++) {
+        std::copy(window.data.begin() + i * window.size_y, window.data.begin() + (i + 1) * window.size_y,
+                data.begin() + (i0 + i) * size_y + j0);
+    }
+}
+
 // make a list of indices sorted by data values
 void Raster::sort_data() {
     idx = std::vector<int>(size_x * size_y);
@@ -164,6 +200,17 @@ void Raster::sort_data() {
     std::sort(idx.begin(), idx.end(), [this](int i1, int i2) {return data[i1] < data[i2]; });
 }
 
+void Raster::sort_data(const std::vector<int32_t>& tiebreak) {
+    if (tiebreak.size() != data.size()) {
+        Util::Error("Tiebreak values must match the size of the Raster", 1);
+    }
+    idx = std::vector<int>(size_x * size_y);
+    std::iota(idx.begin(), idx.end(), 0);
+    std::sort(idx.begin(), idx.end(), [this, &tiebreak](int i1, int i2) {
+        return (data[i1] < data[i2]) || (data[i1] == data[i2] && tiebreak[i1] < tiebreak[i2]);
+    });
+}
+
 // return specified element from the ordered data values
 void Raster::get_sorted_ij(int t, int &i, int &j) {
     if (t >= idx.size() || t < 0) {
@@ -187,6 +234,11 @@ void Raster::set_deltax(const real_type deltax_) {
     deltax = deltax_;
 }
 
+void Raster::set_corner(const real_type xllcorner_, const real_type yllcorner_) {
+    xllcorner = xllcorner_;
+    yllcorner = yllcorner_;
+}
+
 /// See http://desktop.arcgis.com/en/arcmap/10.3/tools/spatial-analyst-toolbox/how-slope-works.htm
 /// and http://desktop.arcgis.com/en/arcmap/10.3/tools/spatial-analyst-toolbox/how-aspect-works.htm
 void Raster::compute_slope_and_aspect(const GridNeighbours& nebs) {
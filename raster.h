@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
 #include "grid_neighbours.h"
 #include "global_defs.h"
 
@@ -76,6 +77,10 @@ class Raster {
         /// \param value Set all elements of the raster to this value
         void set_data(real_type value);
 
+        /// \brief Exchange the elements of the raster with a vector of the same length, without copying
+        /// \param other The vector to exchange elements with
+        void swap_data(std::vector<real_type>& other);
+
         /// \brief Check if an element in the raster is set to nodata
         /// \param i First index of the element to check
         /// \param j Second index of the element to check
@@ -86,9 +91,26 @@ class Raster {
         /// \param j Second index of the pixel to set
         void set_pixel_nodata(int i, int j);
 
+        /// \brief Copy a rectangular window of the raster, keeping its position on the ground
+        /// \param i0 First index of the window's first row
+        /// \param j0 Second index of the window's first column
+        /// \param nx Number of cells in the window in the x dimension
+        /// \param ny Number of cells in the window in the y dimension
+        Raster crop(int i0, int j0, int nx, int ny) const;
+
+        /// \brief Copy a raster created by crop() back into its place in this raster
+        /// \param window The raster to copy in
+        /// \param i0 First index of the window's first row
+        /// \param j0 Second index of the window's first column
+        void paste(const Raster& window, int i0, int j0);
+
         /// \brief Create a list of indexes of the data sorted by value (low to high)
         void sort_data();
 
+        /// \brief Create a list of indexes of the data sorted by value, breaking ties between equal values
+        /// \param tiebreak Values indexed in the same way as the data; equal data values are sorted by these (low to high)
+        void sort_data(const std::vector<int32_t>& tiebreak);
+
         /// \brief Find the indices of the specified element from the ordered data values
         /// \param t Find the t'th element from the ordered data values
         /// \param i Set to the first index of the t'th element
@@ -121,6 +143,11 @@ class Raster {
         /// \param deltax_ The new value for the cell size
         void set_deltax(const real_type deltax_);
 
+        /// \brief Set the coordinates of the lower left corner
+        /// \param xllcorner_ The new x coordinate of the lower left corner
+        /// \param yllcorner_ The new y coordinate of the lower left corner
+        void set_corner(const real_type xllcorner_, const real_type yllcorner_);
+
         /// \brief Compute the slope and aspect of the DEM
         void compute_slope_and_aspect(const GridNeighbours& nebs);
 
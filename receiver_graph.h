@@ -0,0 +1,24 @@
+#ifndef _RECEIVER_GRAPH_H_
+#define _RECEIVER_GRAPH_H_
+
+#include <vector>
+#include "global_defs.h"
+
+/// \brief Compressed sparse row (CSR) graph of the cells each cell passes flow to
+///
+/// Cells are indexed in the same way as the Raster data (i * size_y + j). The
+/// receivers of cell c are receivers[offsets[c]] to receivers[offsets[c + 1] - 1],
+/// with the fraction of c's flow each of them gets in weights. Routing another
+/// quantity (sediment, meltwater, ...) the same way as the flow means visiting
+/// the cells in order and passing value[c] * weight on to each receiver.
+///
+/// Edge cells with boundary inflow also list neighbours with a zero weight, since
+/// the inflow is added to all of their neighbours.
+struct ReceiverGraph {
+    std::vector<int> offsets;  ///< Start of each cell's receivers, size is number of cells + 1
+    std::vector<int> receivers;  ///< Receiving cells
+    std::vector<real_type> weights;  ///< Fraction of the cell's flow passed to each receiver
+    std::vector<int> order;  ///< Cells from highest to lowest, so donors come before their receivers
+};
+
+#endif
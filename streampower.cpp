@@ -16,7 +16,7 @@
 #include "model_time.h"
 #include "timer.hpp"
 #include "raster.h"
-#include "mfd_flow_router.h"
+#include "flow_router.h"
 #include "grid_neighbours.h"
 #include "parameters.h"
 #include "solar_geometry.h"
@@ -43,6 +43,22 @@ real_type StreamPower::Gasdev(std::default_random_engine& generator, std::normal
 void StreamPower::SetTopo()
 {
 	topo = Raster(params.get_topo_file());
+
+    // restrict the model to the window holding the catchment of [domain] outlet_i, outlet_j
+    domain.initialise(topo, params.get_domain_outlet_i(), params.get_domain_outlet_j());
+    if (domain.is_restricted()) {
+        topo = domain.crop(topo);
+        flow = domain.crop(flow);
+        domain.crop_inflow(flow);
+        domain.freeze(topo);
+        int full_cells = domain.get_full_size_x() * domain.get_full_size_y();
+        int window_cells = domain.get_size_x() * domain.get_size_y();
+        std::cout << "Domain: catchment of (" << params.get_domain_outlet_i() << ", " << params.get_domain_outlet_j()
+                << ") has " << domain.get_num_active() << " cells, window " << domain.get_size_x() << " x "
+                << domain.get_size_y() << " at (" << domain.get_i_min() << ", " << domain.get_j_min() << "), "
+                << window_cells << " of " << full_cells << " cells (" << 100.0 * window_cells / full_cells
+                << " %) processed per step" << std::endl;
+    }
     lattice_size_x = topo.get_size_x();
     lattice_size_y = topo.get_size_y();
     xllcorner = topo.get_xllcorner();
@@ -88,6 +104,7 @@ void StreamPower::InitDiffusion()
 			}
 		}
 	}
+    domain.restore(topo);
 }
 
 void StreamPower::Init(std::string parameter_file)
@@ -103,11 +120,37 @@ void StreamPower::Init(std::string parameter_file)
 	SetTopo();
 
     // initialise components
-    mfd_flow_router.initialise(flow);
+    flow_router = create_flow_router(params.get_flow_router());
+    flow_router->initialise(flow, params);
+    std::cout << "Flow router: " << flow_router->get_scheme_name() << std::endl;
+    if (!params.get_inflow_hydrograph_file().empty()) {
+        inflow_hydrograph.load(params.get_inflow_hydrograph_file());
+        std::cout << "Loaded inflow hydrograph with " << inflow_hydrograph.size() << " rows: "
+                << params.get_inflow_hydrograph_file() << std::endl;
+    }
     radiation_model.initialise(topo, params);
     flood.initialise(topo, params);
+    flat_resolution.initialise(topo);
     hillslope_diffusion.initialise(topo, params);
     avalanche.initialise(topo);
+    avalanche.set_track_mass(params.get_avalanche_track_mass());
+    avalanche.set_melt_in_sweep(!params.get_melt_stage());
+    implicit_stream_power.initialise(topo);
+    if (params.get_lazy_routing()) {
+        lazy_routing.initialise(topo, params);
+        if (params.get_lazy_validate()) {
+            validation_router = create_flow_router(params.get_flow_router());
+            validation_router->initialise(flow, params);
+            validation_flood.initialise(topo, params);
+            validation_flats.initialise(topo);
+        }
+    }
+
+    // quantities routed downstream along with the flow
+    tracers.reset(lattice_size_x * lattice_size_y);
+    meltwater_tracer = params.get_route_meltwater() ? tracers.add("meltwater") : -1;
+    sediment_tracer = params.get_route_sediment() ? tracers.add("sediment") : -1;
+    eroded = Raster(lattice_size_x, lattice_size_y, 0.0);
 
     // Initialise diffusion
 	InitDiffusion();
@@ -118,21 +161,21 @@ void StreamPower::Start()
     if (params.get_save_topo()) {
         char fname[100];
         sprintf(fname, "erosion_%04i_%03i_%02i.asc", ct.get_year(), ct.get_day(), ct.get_hour());
-        topo.save(fname);
+        save_raster(topo, fname);
     }
     if (params.get_save_flow()) {
         char fname[100];
         sprintf(fname, "flow_%04i_%03i_%02i.asc", ct.get_year(), ct.get_day(), ct.get_hour());
-        flow.save(fname);
+        save_raster(flow, fname);
     }
 	int tstep = 0;    // Counter for printing results to file
 	std::cout << "U: " << params.get_U() << "; K: " << params.get_K() << "; D: " << params.get_D() << std::endl;
 
     // set up some timers
     AccumulateTimer<std::chrono::milliseconds> total_time;
-    std::vector<std::string> timer_names {"Avalanche", "Flood", "Sort", "MFDFlowRoute",
+    std::vector<std::string> timer_names {"Avalanche", "Flood", "Sort", "FlowRoute",
         "HillSlopeDiffusion", "Uplift", "SlopeAspect", "SolarCharacteristics",
-        "MeltPotential", "ChannelErosion"};
+        "MeltPotential", "Melt", "ChannelErosion", "FlatResolution", "LazyRouting", "LazyValidation"};
     std::map<std::string, AccumulateTimer<std::chrono::milliseconds> > timers;
     for (auto timer_name : timer_names) {
         timers[timer_name] = AccumulateTimer<std::chrono::milliseconds>();
@@ -165,33 +208,109 @@ void StreamPower::Start()
 
         // flow routing
         if (params.get_flow_routing()) {
-            // Flood - pit filling required for flow router
+            set_tracer_sources();
+            TracerSet* routed_tracers = (tracers.get_num_tracers() > 0) ? &tracers : nullptr;
+
+            // boundary inflow for this time of the season
+            bool inflow_changed = false;
+            if (inflow_hydrograph.size() > 0) {
+                real_type scale = inflow_hydrograph.scale(ct.get_day(), ct.get_hour());
+                inflow_changed = flow_router->set_inflow_scale(scale);
+                if (validation_router) {
+                    validation_router->set_inflow_scale(scale);
+                }
+            }
+
+            // Flood - pit filling required for flow router, and done every step as channel
+            // erosion works on the filled surface even when the cached flow is kept
             timers["Flood"].start();
             flood.run(topo, nebs);
             timers["Flood"].stop();
 
-            // sort data before flow routing
-            timers["Sort"].start();
-            topo.sort_data();
-            timers["Sort"].stop();
+            // with lazy routing the cached flow is kept while the topography has barely changed
+            bool route = true;
+            if (params.get_lazy_routing()) {
+                timers["LazyRouting"].start();
+                route = inflow_changed || lazy_routing.needs_routing(topo);
+                if (route) {
+                    lazy_routing.routed(topo);
+                }
+                timers["LazyRouting"].stop();
+
+                if (!route && params.get_lazy_validate()) {
+                    timers["LazyValidation"].start();
+                    validate_lazy_routing();
+                    timers["LazyValidation"].stop();
+                }
+            }
 
-            // MFD flow router
-            timers["MFDFlowRoute"].start();
-            mfd_flow_router.run(topo, flow, nebs);
-            timers["MFDFlowRoute"].stop();
+            if (route) {
+                if (params.get_flat_resolution()) {
+                    // drainage directions over flats, without altering topo
+                    timers["FlatResolution"].start();
+                    flat_resolution.run(topo);
+                    timers["FlatResolution"].stop();
+
+                    // sort data before flow routing, ordering cells on flats by the flat mask
+                    timers["Sort"].start();
+                    topo.sort_data(flat_resolution.get_mask());
+                    timers["Sort"].stop();
+
+                    // MFD flow router
+                    timers["FlowRoute"].start();
+                    if (params.get_basin_parallel() && flood.has_labels()) {
+                        flow_router->run_basins(topo, flow, nebs, flood.get_labels(), &flat_resolution, routed_tracers);
+                    }
+                    else if (params.get_parallel_accumulation()) {
+                        flow_router->run_parallel(topo, flow, nebs, &flat_resolution, routed_tracers);
+                    }
+                    else {
+                        flow_router->run(topo, flow, nebs, &flat_resolution, routed_tracers);
+                    }
+                    timers["FlowRoute"].stop();
+                }
+                else {
+                    // sort data before flow routing
+                    timers["Sort"].start();
+                    topo.sort_data();
+                    timers["Sort"].stop();
+
+                    // MFD flow router
+                    timers["FlowRoute"].start();
+                    if (params.get_basin_parallel() && flood.has_labels()) {
+                        flow_router->run_basins(topo, flow, nebs, flood.get_labels(), nullptr, routed_tracers);
+                    }
+                    else if (params.get_parallel_accumulation()) {
+                        flow_router->run_parallel(topo, flow, nebs, nullptr, routed_tracers);
+                    }
+                    else {
+                        flow_router->run(topo, flow, nebs, nullptr, routed_tracers);
+                    }
+                    timers["FlowRoute"].stop();
+                }
+            }
+            else if (routed_tracers != nullptr) {
+                // the tracer sources change every step, so route them along the cached graph
+                timers["FlowRoute"].start();
+                flow_router->route_tracers(tracers);
+                timers["FlowRoute"].stop();
+            }
         }
 
 		// Channel erosion
         real_type maxe = 0;
         if (params.get_channel_erosion()) {
-            // Slope/Aspect required for channel erosion
-            timers["SlopeAspect"].start();
-            topo.compute_slope_and_aspect(nebs);
-            timers["SlopeAspect"].stop();
+            // Slope/Aspect required for explicit channel erosion, the implicit solver uses its receivers
+            if (!params.get_implicit_channel_erosion()) {
+                timers["SlopeAspect"].start();
+                topo.compute_slope_and_aspect(nebs);
+                timers["SlopeAspect"].stop();
+            }
 
             // Channel erosion
             timers["ChannelErosion"].start();
             maxe = channel_erosion();
+            domain.restore(topo);
             timers["ChannelErosion"].stop();
         }
 
@@ -199,26 +318,66 @@ void StreamPower::Start()
 
 		// Landsliding
         if (params.get_avalanche()) {
+            avalanche.clear_melt_lowered(radiation_model.get_melt_cells());
+
             // Flood - remove pits and flats required for avalanching
             timers["Flood"].start();
             flood.run(topo, nebs);
             timers["Flood"].stop();
 
-            // sort data before avalanching
-            timers["Sort"].start();
-            topo.sort_data();
-            timers["Sort"].stop();
+            // sort data before avalanching, the worklist finds its own order
+            if (!params.get_avalanche_worklist()) {
+                timers["Sort"].start();
+                topo.sort_data();
+                timers["Sort"].stop();
+            }
+
+            // apply melt potential as its own stage, after the flood as in the sweep, so the
+            // sweep still visits cells in their pre-melt order
+            if (params.get_melt_stage()) {
+                timers["Melt"].start();
+                avalanche.apply_melt(topo, radiation_model.incoming_watts, params.get_melt(),
+                        radiation_model.get_melt_cells(), nebs);
+                timers["Melt"].stop();
+            }
 
-            // apply melt potential and avalanche
+            // apply melt potential (unless applied above) and avalanche
             timers["Avalanche"].start();
-            avalanche.run(topo, Sed_Track, radiation_model.incoming_watts, params.get_melt(), nebs);
+            if (params.get_avalanche_worklist()) {
+                avalanche.run_worklist(topo, Sed_Track, radiation_model.incoming_watts, params.get_melt(), nebs);
+            }
+            else if (params.get_avalanche_band_height() > 0) {
+                avalanche.run_bands(topo, Sed_Track, radiation_model.incoming_watts, params.get_melt(), nebs,
+                        params.get_avalanche_band_height());
+            }
+            else if (params.get_basin_parallel() && flood.has_labels()) {
+                avalanche.run_basins(topo, Sed_Track, radiation_model.incoming_watts, params.get_melt(), nebs,
+                        flood.get_labels());
+            }
+            else {
+                avalanche.run(topo, Sed_Track, radiation_model.incoming_watts, params.get_melt(), nebs);
+            }
+            domain.restore(topo);
             timers["Avalanche"].stop();
         }
 
 		// Diffusive hillslope erosion
         if (params.get_diffusive_erosion()) {
             timers["HillSlopeDiffusion"].start();
+            if ((params.get_diffusion_solver() == "multigrid" || params.get_diffusion_transport() == "nonlinear")
+                    && params.get_saturated_D() > 0) {
+                // saturated sediment below ice that melted this step diffuses faster
+                Raster& diffusivity = hillslope_diffusion.get_diffusivity();
+                diffusivity.set_data(params.get_D());
+                for (int c : radiation_model.get_melt_cells()) {
+                    if (params.get_avalanche() && avalanche.get_melt_lowered(c)) {
+                        diffusivity[c] = params.get_saturated_D();
+                    }
+                }
+            }
             hillslope_diffusion.run(topo, flow, nebs);
+            timers["HillSlopeDiffusion"].add_bytes(hillslope_diffusion.get_bytes_moved());
+            domain.restore(topo);
             timers["HillSlopeDiffusion"].stop();
         }
 
@@ -228,6 +387,7 @@ void StreamPower::Start()
         if (params.get_uplift()) {
             timers["Uplift"].start();
             uplift();
+            domain.restore(topo);
             timers["Uplift"].stop();
         }
 
@@ -273,12 +433,30 @@ void StreamPower::Start()
             if (params.get_save_topo()) {
                 char fname[100];
                 sprintf(fname, "erosion_%04i_%03i_%02i_%.3f.asc", ct.get_year(), ct.get_day(), ct.get_hour(), radiation_model.get_solar_altitude() );
-                topo.save(fname);
+                save_raster(topo, fname);
             }
             if (params.get_save_flow()) {
                 char fname[100];
                 sprintf(fname, "flow_%04i_%03i_%02i_%.3f.asc", ct.get_year(), ct.get_day(), ct.get_hour(), radiation_model.get_solar_altitude() );
-                flow.save(fname);
+                save_raster(flow, fname);
+            }
+            if (params.get_flow_routing() && params.get_save_flow_graph()) {
+                char fname[100];
+                sprintf(fname, "flow_graph_%04i_%03i_%02i_%.3f.bin", ct.get_year(), ct.get_day(), ct.get_hour(), radiation_model.get_solar_altitude() );
+                flow_index.build(flow_router->get_graph(), lattice_size_x, lattice_size_y, deltax);
+            flow_index.set_window(domain.get_i_min(), domain.get_j_min(), domain.get_full_size_x(),
+                    domain.get_full_size_y(), domain.get_xllcorner(), domain.get_yllcorner());
+                flow_index.save(fname);
+            }
+            for (int k = 0; k < tracers.get_num_tracers(); k++) {
+                Raster routed = flow;
+                const real_type* values = tracers.tracer(k);
+                for (int n = 0; n < lattice_size_x * lattice_size_y; n++) {
+                    routed[n] = values[n];
+                }
+                char fname[100];
+                sprintf(fname, "%s_%04i_%03i_%02i_%.3f.asc", tracers.get_name(k).c_str(), ct.get_year(), ct.get_day(), ct.get_hour(), radiation_model.get_solar_altitude() );
+                save_raster(routed, fname);
             }
             if (params.get_melt_component() && params.get_debug_melt()) {
                 char prefix[100];
@@ -298,7 +476,48 @@ void StreamPower::Start()
     for (auto item : timers) {
         double item_time_secs = item.second.get_total_time() / 1000.0;
         std::cout << "    " << item.first << ": " << item_time_secs << " s";
-        std::cout << " (" << item_time_secs / total_time_secs * 100 << " %)" << std::endl;
+        std::cout << " (" << item_time_secs / total_time_secs * 100 << " %)";
+        double item_bytes = item.second.get_total_bytes();
+        if (item_bytes > 0) {
+            std::cout << ", " << item_bytes / 1e9 << " GB moved";
+            if (item_time_secs > 0) {
+                std::cout << " (" << item_bytes / 1e9 / item_time_secs << " GB/s)";
+            }
+        }
+        std::cout << std::endl;
+    }
+    if (params.get_flow_routing() && params.get_lazy_routing()) {
+        std::cout << "  Lazy routing: " << lazy_routing.get_routings() << " routings (" << lazy_routing.get_forced()
+                << " forced), " << lazy_routing.get_skipped() << " skipped" << std::endl;
+        if (params.get_lazy_validate()) {
+            std::cout << "  Lazy routing: relative flow error over " << lazy_routing.get_validations()
+                    << " skipped steps: worst " << lazy_routing.get_max_error() << ", mean "
+                    << lazy_routing.get_mean_error() << std::endl;
+        }
+    }
+    if (params.get_avalanche() && params.get_avalanche_worklist() && avalanche.get_worklist_calls() > 0) {
+        int calls = avalanche.get_worklist_calls();
+        std::cout << "  Avalanche worklist: per step " << avalanche.get_worklist_seeds() / calls << " starting cells, "
+                << avalanche.get_worklist_iterations() / calls << " iterations, "
+                << avalanche.get_worklist_touched() / calls << " cells melted or lowered" << std::endl;
+    }
+    if (params.get_avalanche() && params.get_avalanche_track_mass()) {
+        std::cout << "  Avalanche mass balance: " << avalanche.get_total_failed_volume() << " m3 failed, "
+                << avalanche.get_total_deposited_volume() << " m3 deposited" << std::endl;
+    }
+    if (params.get_diffusive_erosion() && params.get_diffusion_min_change() > 0) {
+        const std::vector<long>& counts = hillslope_diffusion.get_iteration_counts();
+        std::cout << "  Diffusion iterations (iterations: calls):";
+        for (size_t n = 0; n < counts.size(); n++) {
+            if (counts[n] > 0) {
+                std::cout << " " << n << ": " << counts[n];
+            }
+        }
+        std::cout << std::endl;
+    }
+    if (params.get_flood_incremental()) {
+        std::cout << "  Flood: " << flood.get_full_floods() << " full, " << flood.get_incremental_floods()
+                << " incremental (" << flood.get_cells_reflooded() << " cells re-flooded)" << std::endl;
     }
     std::cout << std::endl;
 }
@@ -315,9 +534,23 @@ void StreamPower::uplift() {
     }
 }
 
+/// With a restricted domain the window is written into a raster covering the full grid
+void StreamPower::save_raster(Raster& raster, const char* filename) {
+    if (domain.is_restricted()) {
+        domain.expand(raster).save(filename);
+    }
+    else {
+        raster.save(filename);
+    }
+}
+
 real_type StreamPower::channel_erosion() {
     real_type maxe = 0.0;
     real_type K = params.get_K();
+    if (params.get_implicit_channel_erosion()) {
+        return implicit_stream_power.run(topo, flow, eroded, K, params.get_ann_timestep(), nebs);
+    }
+
     #pragma omp parallel for reduction(max: maxe)
     for (int i = 1; i <= lattice_size_x - 2; i++)
     {
@@ -325,12 +558,14 @@ real_type StreamPower::channel_erosion() {
         {
             real_type flow_sqrt = sqrt(flow(i, j) / 1e6);
             real_type deltah = params.get_ann_timestep() * K * flow_sqrt * deltax * topo.slope(i, j);     // Fluvial erosion law;
+            real_type old_topo = topo(i, j);
             topo(i, j) -= deltah;
             //std::cout << "ann_ts: " << ann_timestep << ", K: " << K << ", flow: " << flow(i, j) / 1e6 << ", slope: " << slope(i, j) << std::endl;
 
             if ( topo(i, j) < 0 ) {
                 topo(i, j) = 0;
             }
+            eroded(i, j) = (old_topo - topo(i, j)) * deltax2;
             if ( K * flow_sqrt * deltax > maxe ) {
                 maxe = K * flow_sqrt * deltax;
             }
@@ -340,6 +575,50 @@ real_type StreamPower::channel_erosion() {
     return maxe;
 }
 
+/// Route the flow for the current topo without touching the model state, to measure
+/// the error of the cached flow on a step that lazy routing skips.
+void StreamPower::validate_lazy_routing() {
+    Raster check_topo = topo;
+    Raster check_flow = flow;
+    validation_flood.run(check_topo, nebs);
+    if (params.get_flat_resolution()) {
+        validation_flats.run(check_topo);
+        check_topo.sort_data(validation_flats.get_mask());
+        validation_router->run(check_topo, check_flow, nebs, &validation_flats);
+    }
+    else {
+        check_topo.sort_data();
+        validation_router->run(check_topo, check_flow, nebs);
+    }
+    lazy_routing.record_error(flow, check_flow);
+}
+
+/// Fill the tracers with the amount generated in each cell this time step. Meltwater
+/// is the volume of ice the melt potential would remove (applied later by Avalanche,
+/// which only melts interior cells). Sediment is the volume removed by the previous
+/// channel erosion step, since channel erosion needs the routed flow of this step.
+void StreamPower::set_tracer_sources() {
+    if (meltwater_tracer >= 0) {
+        real_type* meltwater = tracers.tracer(meltwater_tracer);
+        real_type melt = params.get_melt();
+        bool melting = params.get_melt_component();
+        #pragma omp parallel for
+        for (int i = 0; i < lattice_size_x; i++) {
+            for (int j = 0; j < lattice_size_y; j++) {
+                bool interior = (i > 0) && (i < lattice_size_x - 1) && (j > 0) && (j < lattice_size_y - 1);
+                meltwater[i * lattice_size_y + j] = (melting && interior) ? radiation_model.incoming_watts(i, j) / melt : 0;
+            }
+        }
+    }
+    if (sediment_tracer >= 0) {
+        real_type* sediment = tracers.tracer(sediment_tracer);
+        #pragma omp parallel for
+        for (int n = 0; n < lattice_size_x * lattice_size_y; n++) {
+            sediment[n] = eroded[n];
+        }
+    }
+}
+
 Raster StreamPower::CreateRandomField()
 {
     Raster mat(lattice_size_x, lattice_size_y);
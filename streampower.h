@@ -8,13 +8,20 @@
 #include "global_defs.h"
 #include "model_time.h"
 #include "raster.h"
-#include "mfd_flow_router.h"
+#include "flow_router.h"
 #include "grid_neighbours.h"
 #include "parameters.h"
 #include "hillslope_diffusion.h"
 #include "radiation_model.h"
 #include "avalanche.h"
 #include "flood.h"
+#include "flat_resolution.h"
+#include "tracer_set.h"
+#include "lazy_routing.h"
+#include "inflow_hydrograph.h"
+#include "flow_query_index.h"
+#include "domain_mask.h"
+#include "implicit_stream_power.h"
 
 #define NR_END 1
 #define FREE_ARG char*
@@ -46,12 +53,24 @@ public:
     Raster topo;
     Raster flow;
 	Raster veg, veg_old, Sed_Track, ExposureAge, ExposureAge_old;
-    MFDFlowRouter mfd_flow_router;
+    std::shared_ptr<FlowRouterBase> flow_router;  ///< Router for the scheme chosen by [flow] router
     GridNeighbours nebs;
     HillSlopeDiffusion hillslope_diffusion;
     RadiationModel radiation_model;
     Avalanche avalanche;
     Flood flood;
+    ImplicitStreamPower implicit_stream_power;
+    FlatResolution flat_resolution;
+    TracerSet tracers;        ///< Meltwater and sediment routed along with the flow
+    int meltwater_tracer, sediment_tracer;  ///< Index of each tracer in tracers, -1 if not routed
+    Raster eroded;            ///< Volume removed from each cell by the last channel erosion step
+    LazyRouting lazy_routing;
+    InflowHydrograph inflow_hydrograph;   ///< Seasonal scaling of the boundary inflow
+    std::shared_ptr<FlowRouterBase> validation_router;  ///< Separate router, flood and flats used to check lazy routing
+    Flood validation_flood;
+    FlatResolution validation_flats;
+    DomainMask domain;        ///< Catchment the model is restricted to, see [domain]
+    FlowQueryIndex flow_index;   ///< Upstream/downstream query index over the last saved receiver graph
 
 	ModelTime ct;             ///< Current model time
 
@@ -60,7 +79,10 @@ public:
 	static real_type Gasdev(std::default_random_engine& generator, std::normal_distribution<real_type>& distribution);
 
     real_type channel_erosion();
+    void set_tracer_sources();
+    void validate_lazy_routing();
     void uplift();
+    void save_raster(Raster& raster, const char* filename);
 
 	StreamPower(int nx, int ny);
 	~StreamPower();
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "raster.h"
+#include "grid_neighbours.h"
+#include "hillslope_diffusion.h"
+#include "parameters.h"
+#include "timer.hpp"
+#include "utility.h"
+
+
+/// Strong scaling of the batched hillslope diffusion on a skinny grid, solving the
+/// lines with the Thomas algorithm and with parallel cyclic reduction
+int main(int argc, char** argv) {
+    // usage: bench_diffusion [size_x] [size_y] [repeats] [max_threads]
+    if (argc > 5) {
+        std::cerr << "Usage: bench_diffusion [size_x] [size_y] [repeats] [max_threads]" << std::endl;
+        return 1;
+    }
+    int size_x = (argc >= 2) ? std::atoi(argv[1]) : 65536;
+    int size_y = (argc >= 3) ? std::atoi(argv[2]) : 8;
+    int repeats = (argc >= 4) ? std::atoi(argv[3]) : 5;
+    int max_threads = (argc >= 5) ? std::atoi(argv[4]) : 64;
+
+    // rough surface, diffusing everywhere
+    Raster topo(size_x, size_y, 0.0);
+    topo.set_deltax(1.0);
+    for (int i = 0; i < size_x; i++) {
+        for (int j = 0; j < size_y; j++) {
+            topo(i, j) = std::sin(0.1 * i) + std::cos(0.7 * j) + 0.01 * ((i * 31 + j * 17) % 13);
+        }
+    }
+    Raster flow(size_x, size_y, 0.0);
+    GridNeighbours nebs(size_x, size_y);
+    Parameters params;
+    params.set_thresholdarea(1.0);
+    params.set_diffusion_batched(true);
+
+    std::cout << size_x << " x " << size_y << " grid" << std::endl;
+    std::cout << "threads  solver    ms/run   speedup   max diff" << std::endl;
+    double base_time = 0;
+    Raster reference;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#else
+        if (threads > 1) {
+            std::cout << "built without OpenMP, skipping more threads" << std::endl;
+            break;
+        }
+#endif
+        for (std::string solver : {"thomas", "pcr"}) {
+            params.set_diffusion_line_solver(solver);
+            HillSlopeDiffusion diffusion;
+            diffusion.initialise(topo, params);
+            Raster result = topo;
+            AccumulateTimer<std::chrono::milliseconds> timer;
+            for (int r = 0; r < repeats; r++) {
+                result = topo;
+                timer.start();
+                diffusion.run(result, flow, nebs);
+                timer.stop();
+            }
+            double time = std::max(timer.get_total_time() / (double) repeats, 1.0);
+            if (threads == 1 && solver == "thomas") {
+                base_time = time;
+                reference = result;
+            }
+            real_type max_diff = 0;
+            for (int n = 0; n < size_x * size_y; n++) {
+                max_diff = std::max<real_type>(max_diff, std::abs(result[n] - reference[n]));
+            }
+            printf("%7d  %-6s %9.1f %9.2f %10.2e\n", threads, solver.c_str(), time, base_time / time, max_diff);
+        }
+    }
+
+    return 0;
+}
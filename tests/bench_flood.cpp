@@ -0,0 +1,58 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "raster.h"
+#include "flood.h"
+#include "grid_neighbours.h"
+#include "parameters.h"
+#include "timer.hpp"
+
+
+/// Time each flood algorithm on a DEM, starting from the unflooded DEM every repeat
+int main(int argc, char** argv) {
+    // usage: bench_flood <topo_file> [repeats]
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: bench_flood <topo_file> [repeats]" << std::endl;
+        return 1;
+    }
+    std::string topo_file = argv[1];
+    int repeats = (argc == 3) ? std::atoi(argv[2]) : 5;
+
+    std::cout << "Topo file = " << topo_file << std::endl;
+    Raster original(topo_file);
+    GridNeighbours nebs(original.get_size_x(), original.get_size_y());
+
+    struct Variant {
+        std::string name;
+        int algorithm;
+        bool parallel_fill;
+    };
+    Variant variants[] = {
+        {"fillinpitsandflats", 0, false},
+        {"fillinpitsandflats (wavefront)", 0, true},
+        {"original_priority_flood", 1, false},
+        {"priority_flood_epsilon", 2, false},
+    };
+
+    for (const Variant& variant : variants) {
+        Parameters params;
+        params.set_flood_algorithm(variant.algorithm);
+        params.set_flood_parallel_fill(variant.parallel_fill);
+
+        Raster topo = original;
+        Flood flood;
+        flood.initialise(topo, params);
+
+        AccumulateTimer<std::chrono::milliseconds> timer;
+        for (int r = 0; r < repeats; r++) {
+            topo = original;
+            timer.start();
+            flood.run(topo, nebs);
+            timer.stop();
+        }
+        std::cout << "  " << variant.name << ": " << timer.get_total_time() / repeats << " ms per flood" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include "raster.h"
+#include "flood.h"
+#include "flow_router.h"
+#include "grid_neighbours.h"
+#include "parameters.h"
+#include "timer.hpp"
+#include "utility.h"
+
+
+/// Time the serial router for each partition scheme, then the serial MFD router against the
+/// parallel donor counting accumulator
+int main(int argc, char** argv) {
+    // usage: bench_flow_routing <topo_file> <fa_file> [repeats] [max_threads]
+    if (argc < 3 || argc > 5) {
+        std::cerr << "Usage: bench_flow_routing <topo_file> <fa_file> [repeats] [max_threads]" << std::endl;
+        return 1;
+    }
+    int repeats = (argc >= 4) ? std::atoi(argv[3]) : 5;
+    int max_threads = (argc >= 5) ? std::atoi(argv[4]) : 64;
+
+    Raster topo(argv[1]);
+    Raster flow(argv[2]);
+    GridNeighbours nebs(topo.get_size_x(), topo.get_size_y());
+
+    // flood and sort once, as in StreamPower::Start()
+    Parameters params;
+    Flood flood;
+    flood.initialise(topo, params);
+    flood.run(topo, nebs);
+    topo.sort_data();
+
+    // cells per second for each scheme, including building the receiver graph
+    double ncells = (double) topo.get_size_x() * topo.get_size_y();
+    std::cout << "scheme    ms/run    Mcells/s    edges/cell" << std::endl;
+    for (std::string scheme : {"d8", "dinf", "mfd"}) {
+        std::shared_ptr<FlowRouterBase> scheme_router = create_flow_router(scheme);
+        scheme_router->initialise(flow, params);
+        Raster scheme_flow = flow;
+        AccumulateTimer<std::chrono::milliseconds> timer;
+        for (int r = 0; r < repeats; r++) {
+            timer.start();
+            scheme_router->run(topo, scheme_flow, nebs);
+            timer.stop();
+        }
+        double time = std::max(timer.get_total_time() / (double) repeats, 1.0);
+        printf("%-6s %9.1f %11.2f %13.2f\n", scheme.c_str(), time, ncells / time / 1000.0,
+                scheme_router->get_graph().receivers.size() / ncells);
+    }
+    std::cout << std::endl;
+
+    MFDFlowRouter router;
+    router.initialise(flow);
+    Raster serial_flow = flow;
+
+    AccumulateTimer<std::chrono::milliseconds> serial_timer;
+    for (int r = 0; r < repeats; r++) {
+        serial_timer.start();
+        router.run(topo, serial_flow, nebs);
+        serial_timer.stop();
+    }
+    double serial_time = serial_timer.get_total_time() / repeats;
+    std::cout << "serial: " << serial_time << " ms" << std::endl;
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#else
+        if (threads > 1) {
+            std::cout << "built without OpenMP, skipping more threads" << std::endl;
+            break;
+        }
+#endif
+        AccumulateTimer<std::chrono::milliseconds> timer;
+        for (int r = 0; r < repeats; r++) {
+            timer.start();
+            router.run_parallel(topo, flow, nebs);
+            timer.stop();
+        }
+        double time = timer.get_total_time() / repeats;
+
+        bool same = true;
+        for (int n = 0; n < topo.get_size_x() * topo.get_size_y(); n++) {
+            same = same && (flow[n] == serial_flow[n]);
+        }
+        std::cout << "parallel, " << threads << " threads: " << time << " ms, speedup " << serial_time / std::max(time, 1.0)
+            << (same ? "" : " (DIFFERS FROM SERIAL)") << std::endl;
+    }
+
+    return 0;
+}
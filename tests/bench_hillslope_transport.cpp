@@ -0,0 +1,79 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "raster.h"
+#include "grid_neighbours.h"
+#include "hillslope_diffusion.h"
+#include "parameters.h"
+#include "timer.hpp"
+
+
+/// Cost per simulated year of nonlinear (critical slope) hillslope transport with
+/// hour scale implicit steps, against the linear ADI scheme run at the timestep an
+/// explicit scheme would need to be stable with the steepest nonlinear diffusivity
+int main(int argc, char** argv) {
+    // usage: bench_hillslope_transport [size] [steps]
+    if (argc > 3) {
+        std::cerr << "Usage: bench_hillslope_transport [size] [steps]" << std::endl;
+        return 1;
+    }
+    int size = (argc >= 2) ? std::atoi(argv[1]) : 256;
+    int steps = (argc >= 3) ? std::atoi(argv[2]) : 5;
+
+    // rough slope with a thaw slump headwall, near vertical, across the middle
+    Raster topo(size, size, 0.0);
+    topo.set_deltax(1.0);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            topo(i, j) = 0.1 * (size - i) + (i < size / 2 ? 5.0 : 0.0) + 0.01 * ((i * 31 + j * 17) % 13);
+        }
+    }
+    Raster flow(size, size, 0.0);
+    GridNeighbours nebs(size, size);
+    Parameters params;
+    params.set_thresholdarea(1.0);
+    params.set_diffusion_min_change(1e-6);
+
+    real_type max_factor = 1 / (1 - HillSlopeDiffusion::max_slope_ratio * HillSlopeDiffusion::max_slope_ratio);
+    real_type explicit_hours = 8760 * topo.get_deltax() * topo.get_deltax() / (4 * params.get_D() * max_factor);
+
+    std::cout << size << " x " << size << " grid, explicit stable step " << explicit_hours << " h" << std::endl;
+    std::cout << "transport   step (h)  iterations  ms/step    s/year" << std::endl;
+    auto run = [&](const char* transport, real_type hours) {
+        params.set_diffusion_transport(transport);
+        // one ADI iteration is one linear step, the nonlinear steps converge their V-cycles
+        params.set_diffusion_max_iterations(std::string(transport) == "linear" ? 1 : 20);
+        params.set_timestep(hours);
+        HillSlopeDiffusion diffusion;
+        Raster result = topo;
+        diffusion.initialise(result, params);
+        AccumulateTimer<std::chrono::microseconds> timer;
+        for (int s = 0; s < steps; s++) {
+            timer.start();
+            diffusion.run(result, flow, nebs);
+            timer.stop();
+        }
+        long calls = 0;
+        long iterations = 0;
+        const std::vector<long>& counts = diffusion.get_iteration_counts();
+        for (int n = 0; n < (int) counts.size(); n++) {
+            calls += counts[n];
+            iterations += n * counts[n];
+        }
+        double ms_per_step = timer.get_total_time() / 1000.0 / steps;
+        printf("%-10s %9.3f %11.1f %8.2f %9.2f\n", transport, hours, iterations / (double) calls, ms_per_step,
+                ms_per_step * 8760 / hours / 1000.0);
+    };
+
+    run("linear", explicit_hours);
+    run("linear", 1.0);
+    for (real_type hours : {1.0, 24.0, 720.0}) {
+        run("nonlinear", hours);
+    }
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include "raster.h"
+#include "grid_neighbours.h"
+#include "hillslope_diffusion.h"
+#include "multigrid_diffusion.h"
+#include "parameters.h"
+#include "timer.hpp"
+
+
+/// Time and accuracy of one implicit hillslope diffusion step with the ADI sweeps in
+/// one or more substeps, the multigrid V-cycles and the multigrid smoother alone, all
+/// measured against the fully converged backward Euler step
+int main(int argc, char** argv) {
+    // usage: bench_multigrid [size] [years] [repeats]
+    if (argc > 4) {
+        std::cerr << "Usage: bench_multigrid [size] [years] [repeats]" << std::endl;
+        return 1;
+    }
+    int size = (argc >= 2) ? std::atoi(argv[1]) : 257;
+    real_type years = (argc >= 3) ? std::atof(argv[2]) : 10.0;
+    int repeats = (argc >= 4) ? std::atoi(argv[3]) : 3;
+
+    // rough surface, diffusing everywhere but the edges
+    Raster topo(size, size, 0.0);
+    topo.set_deltax(1.0);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            topo(i, j) = std::sin(0.1 * i) + std::cos(0.07 * j) + 0.01 * ((i * 31 + j * 17) % 13);
+        }
+    }
+    Raster flow(size, size, 0.0);
+    GridNeighbours nebs(size, size);
+    Parameters params;
+    params.set_thresholdarea(1.0);
+    params.set_timestep(years * 8760);
+    std::vector<char> fixed(size * size, 0);
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            fixed[i * size + j] = (i == 0 || j == 0 || i == size - 1 || j == size - 1);
+        }
+    }
+    Raster diffusivity(size, size, params.get_D());
+
+    MultigridDiffusion multigrid;
+    multigrid.initialise(size, size);
+    Raster reference = topo;
+    multigrid.solve(reference, diffusivity, fixed, params.get_ann_timestep(), 1e-12, 1000);
+
+    std::cout << size << " x " << size << " grid, D dt / dx^2 = " << params.get_D() * params.get_ann_timestep()
+        << ", " << multigrid.get_num_levels() << " levels" << std::endl;
+    std::cout << "solver        tolerance  iterations    ms/run   max error   (adi iterations are substeps)" << std::endl;
+    auto report = [&](const char* name, real_type tolerance, int iterations, double time, const Raster& result) {
+        real_type max_error = 0;
+        for (int n = 0; n < size * size; n++) {
+            max_error = std::max<real_type>(max_error, std::abs(result[n] - reference[n]));
+        }
+        printf("%-12s %10.0e %11d %9.1f %11.2e\n", name, tolerance, iterations, time, max_error);
+        return max_error;
+    };
+
+    // each ADI iteration is another implicit step, so the ADI sweeps can only be made more
+    // accurate by splitting the year into substeps; these converge on the exact solution of
+    // the diffusion equation, not on the backward Euler step, so the error levels off
+    real_type adi_error = std::numeric_limits<real_type>::max();
+    Raster result = topo;
+    for (int substeps : {1, 4, 16, 64}) {
+        params.set_timestep(years * 8760 / substeps);
+        params.set_diffusion_max_iterations(substeps);
+        HillSlopeDiffusion adi;
+        adi.initialise(topo, params);
+        AccumulateTimer<std::chrono::milliseconds> timer;
+        for (int r = 0; r < repeats; r++) {
+            result = topo;
+            timer.start();
+            adi.run(result, flow, nebs);
+            timer.stop();
+        }
+        adi_error = std::min(adi_error, report("adi", 0, substeps, timer.get_total_time() / (double) repeats, result));
+    }
+    params.set_timestep(years * 8760);
+
+    for (real_type tolerance : {1e-3, 1e-5, 1e-7}) {
+        for (std::string solver : {"multigrid", "smoother"}) {
+            AccumulateTimer<std::chrono::milliseconds> solver_timer;
+            int iterations = 0;
+            for (int r = 0; r < repeats; r++) {
+                result = topo;
+                solver_timer.start();
+                if (solver == "multigrid") {
+                    iterations = multigrid.solve(result, diffusivity, fixed, params.get_ann_timestep(), tolerance, 1000);
+                }
+                else {
+                    iterations = multigrid.solve_smoother_only(result, diffusivity, fixed, params.get_ann_timestep(),
+                            tolerance, 100000);
+                }
+                solver_timer.stop();
+            }
+            real_type error = report(solver.c_str(), tolerance, iterations,
+                    solver_timer.get_total_time() / (double) repeats, result);
+            if (solver == "multigrid" && adi_error > error) {
+                std::cout << "  (no ADI run above reaches this error)" << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}